@@ -0,0 +1,181 @@
+// autoscale.h - Adds and retires decode workers as player load rises and falls
+#pragma once
+
+#include "engine.h"
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+struct AutoscaleConfig {
+    int min_workers = 1;
+    int max_workers = 4;
+    double period_sec = 1.0;            // Between decisions
+    double up_queue_per_worker = 2.0;   // Queued turns per live worker that call for another worker
+    double up_ttft_ms = 1500.0;         // Recent p95 TTFT above this also calls for one
+    double up_cooldown_sec = 3.0;       // Let the last change show in TTFT before adding another
+    double cpu_ceiling = 0.9;           // Adding threads past this share of the cores only adds contention
+    double down_busy_share = 0.25;      // Turns in flight below this share of slots, queue empty...
+    double down_after_sec = 10.0;       // ...for this long retires one worker
+};
+
+// Polls EngineStats and process CPU time on its own thread and grows or
+// shrinks the engine's decode workers between min_workers and max_workers.
+// Scale-down is graceful: the retired worker stops admitting, finishes its
+// turns, then frees its context. Stop the autoscaler before the engine.
+class Autoscaler {
+public:
+    struct Event {
+        double at_sec;
+        int workers;                // Live workers after the change
+        std::string reason;
+    };
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    DialogueEngine& engine;
+    AutoscaleConfig cfg;
+    std::vector<Event> events;
+    Clock::time_point started;
+    Clock::time_point last_change;
+    Clock::time_point idle_since;
+    bool idle = false;
+    double worker_seconds = 0.0;        // Integral of allocated workers (live and draining) over time
+    int peak_workers = 0;               // Allocated, like worker_seconds
+    double last_cpu_sec = -1.0;
+    Clock::time_point last_tick;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    std::thread thread;
+
+    // User + system CPU seconds of this process; negative where unavailable
+    static double process_cpu_sec() {
+#ifndef _WIN32
+        rusage ru;
+        if (getrusage(RUSAGE_SELF, &ru) != 0) return -1.0;
+        return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+#else
+        return -1.0;
+#endif
+    }
+
+    static double seconds(Clock::duration d) { return std::chrono::duration<double>(d).count(); }
+
+    void record(int workers, const std::string& reason) {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back({ seconds(Clock::now() - started), workers, reason });
+    }
+
+    void tick() {
+        auto now = Clock::now();
+        EngineStats st = engine.stats();
+        worker_seconds += (st.workers + st.draining) * seconds(now - last_tick);
+        peak_workers = std::max(peak_workers, st.workers + st.draining);
+        engine.reap_retired();      // Else the last scale-down to min_workers keeps its context until stop()
+
+        // Share of the machine this process kept busy since the last tick
+        double cpu = process_cpu_sec(), cpu_share = -1.0;
+        if (cpu >= 0.0 && last_cpu_sec >= 0.0) {
+            unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+            cpu_share = (cpu - last_cpu_sec) / std::max(seconds(now - last_tick), 1e-3) / cores;
+        }
+        last_cpu_sec = cpu;
+        last_tick = now;
+
+        std::ostringstream why;
+        why << std::fixed << std::setprecision(0);
+        if (st.workers < cfg.min_workers) {
+            why << "below minimum";
+        } else if (st.workers < cfg.max_workers && seconds(now - last_change) >= cfg.up_cooldown_sec &&
+                   (cpu_share < 0.0 || cpu_share < cfg.cpu_ceiling)) {
+            if (st.queue_depth > cfg.up_queue_per_worker * st.workers) why << "queue " << st.queue_depth;
+            else if (st.ttft_p95_ms > cfg.up_ttft_ms) why << "p95 TTFT " << st.ttft_p95_ms << " ms";
+        }
+        if (!why.str().empty()) {
+            idle = false;
+            if (engine.add_worker()) {
+                last_change = now;
+                record(st.workers + 1, why.str());
+            }
+            return;
+        }
+
+        int slots = engine.total_slots();
+        bool quiet = st.queue_depth == 0 && st.active < cfg.down_busy_share * slots;
+        if (!quiet || st.workers <= cfg.min_workers) {
+            idle = false;
+            return;
+        }
+        if (!idle) {
+            idle = true;
+            idle_since = now;
+        }
+        if (seconds(now - idle_since) >= cfg.down_after_sec && engine.retire_worker()) {
+            idle = false;
+            last_change = now;
+            why << st.active << " of " << slots << " slots busy";
+            record(st.workers - 1, why.str());
+        }
+    }
+
+public:
+    Autoscaler(DialogueEngine& e, AutoscaleConfig config) : engine(e), cfg(config) {
+        cfg.min_workers = std::max(1, cfg.min_workers);
+        cfg.max_workers = std::max(cfg.min_workers, cfg.max_workers);
+    }
+
+    ~Autoscaler() { stop(); }
+
+    Autoscaler(const Autoscaler&) = delete;
+    Autoscaler& operator=(const Autoscaler&) = delete;
+
+    void start() {
+        started = last_change = last_tick = Clock::now();
+        last_cpu_sec = process_cpu_sec();
+        thread = std::thread([this] {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping) {
+                cv.wait_for(lock, std::chrono::duration<double>(cfg.period_sec), [this] { return stopping; });
+                if (stopping) break;
+                lock.unlock();
+                tick();
+                lock.lock();
+            }
+        });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (thread.joinable()) thread.join();
+    }
+
+    // Call after stop()
+    void report(std::ostream& out) const {
+        double elapsed = seconds(last_tick - started);
+        out << std::fixed << "\n=== Autoscaling: " << cfg.min_workers << "-" << cfg.max_workers << " workers ===\n";
+        for (const Event& e : events) {
+            out << "  " << std::setprecision(1) << std::setw(7) << e.at_sec << " s  -> " << e.workers
+                << " worker(s)  (" << e.reason << ")\n";
+        }
+        out << "  peak " << peak_workers << " worker(s), " << std::setprecision(1) << worker_seconds
+            << " worker-seconds over " << elapsed << " s (" << cfg.max_workers * elapsed << " at a fixed "
+            << cfg.max_workers << ")\n";
+    }
+};
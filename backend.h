@@ -0,0 +1,464 @@
+// backend.h - Decoding backends for the dialogue engine: llama.cpp and a deterministic mock
+#pragma once
+
+#include "llama.h"
+#include "ggml-cpu.h"
+#include "profiler.h"
+#include "memstats.h"
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <cctype>
+
+// A prefilled slot copied out of one context to be loaded into another
+struct SlotSnapshot {
+    std::vector<uint8_t> kv;        // Backend-specific sequence state
+    std::vector<float> logits;      // Logits for the last prompt token
+    int n_past = 0;
+};
+
+// A backend owns one decoding context with a fixed number of sequence slots.
+// Pointers returned by logits() are only valid until the next prefill()/decode().
+class DialogueBackend {
+public:
+    struct StepToken {
+        int slot;
+        llama_token token;
+    };
+
+    virtual ~DialogueBackend() = default;
+
+    virtual int n_slots() const = 0;
+    virtual int n_vocab() const = 0;
+    virtual const llama_vocab* vocab() const = 0;  // nullptr when there is no real vocabulary
+    virtual llama_token eos() const = 0;
+
+    virtual std::vector<llama_token> tokenize(const std::string& text, int max_tokens) = 0;
+    virtual std::string token_to_piece(llama_token token) = 0;
+
+    // Replace whatever the slot held with `tokens`, leaving logits for the last one
+    virtual bool prefill(int slot, const std::vector<llama_token>& tokens) = 0;
+    // Append one token to each listed slot in a single batched step; fails
+    // as a whole if any listed slot is full, so check has_room() first
+    virtual bool decode(const std::vector<StepToken>& step) = 0;
+    virtual bool has_room(int slot) const = 0;
+    virtual float* logits(int slot) = 0;
+    virtual void release(int slot) = 0;
+
+    // Hand a prefilled slot to another backend over the same model; load_slot()
+    // replaces whatever the slot held and leaves the snapshot's logits current
+    virtual bool save_slot(int slot, SlotSnapshot& out) = 0;
+    virtual bool load_slot(int slot, const SlotSnapshot& in) = 0;
+};
+
+// Equal slices of a core list, handed to backends as they are created and
+// returned when they are destroyed, so a worker added after another retired
+// never lands on cores a live worker is pinned to
+class CoreSlices {
+private:
+    std::mutex mutex;
+    std::vector<int> cpus;
+    std::vector<bool> taken;
+
+public:
+    CoreSlices(std::vector<int> core_list, int count)
+        : cpus(std::move(core_list)), taken(cpus.size() >= (size_t)std::max(1, count) ? std::max(1, count) : 0, false) {}
+
+    // A free slice's index and cores; (-1, none) leaves the backend unpinned
+    std::pair<int, std::vector<int>> take() {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t per = taken.empty() ? 0 : cpus.size() / taken.size();
+        for (size_t i = 0; i < taken.size(); ++i) {
+            if (taken[i]) continue;
+            taken[i] = true;
+            return { (int)i, std::vector<int>(cpus.begin() + i * per, cpus.begin() + (i + 1) * per) };
+        }
+        return { -1, {} };
+    }
+
+    void release(int index) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (index >= 0 && index < (int)taken.size()) taken[index] = false;
+    }
+};
+
+// ---- llama.cpp backend: one context, one KV sequence per slot ----
+class LlamaBackend : public DialogueBackend {
+private:
+    llama_context* ctx = nullptr;
+    const llama_vocab* vocab_ptr = nullptr;
+    llama_batch batch{};
+    int slots = 1;
+    int slot_ctx = 0;                   // Positions available to each slot
+    std::vector<llama_pos> n_past;      // Next position per slot
+    std::vector<int32_t> logits_row;    // Batch row holding each slot's last logits; -1 = loaded
+    std::vector<std::vector<float>> loaded_logits;  // From load_slot(), until the slot's next decode
+    ggml_threadpool* threadpool = nullptr;
+    DecodeProfiler* profiler = nullptr;
+    std::function<void()> on_destroy;   // Runs after the context and threadpool are freed
+
+    LlamaBackend() = default;
+
+    void batch_add(llama_token token, llama_pos pos, int slot, bool want_logits) {
+        int n = batch.n_tokens++;
+        batch.token[n] = token;
+        batch.pos[n] = pos;
+        batch.n_seq_id[n] = 1;
+        batch.seq_id[n][0] = slot;
+        batch.logits[n] = want_logits;
+    }
+
+    int run_batch(DecodeProfiler::Phase phase) {
+        if (profiler) profiler->begin(phase, batch.n_tokens);
+        int rc = llama_decode(ctx, batch);
+        if (profiler) profiler->end();
+        return rc;
+    }
+
+public:
+    // params.n_ctx is the context each slot gets; the KV cache holds all of them.
+    // A non-empty `cpus` runs every graph on a threadpool pinned to those cores.
+    static std::unique_ptr<LlamaBackend> create(llama_model* model, llama_context_params params,
+                                                int n_slots, DecodeProfiler* profiler = nullptr,
+                                                const std::vector<int>& cpus = {}) {
+        std::unique_ptr<LlamaBackend> b(new LlamaBackend());
+        b->slots = std::max(1, n_slots);
+        b->slot_ctx = params.n_ctx;
+        params.n_ctx = params.n_ctx * b->slots;
+        params.n_seq_max = b->slots;
+        if (!cpus.empty()) {
+            params.n_threads = (int)cpus.size();
+            params.n_threads_batch = (int)cpus.size();
+        }
+        b->ctx = llama_init_from_model(model, params);
+        if (!b->ctx) {
+            std::cerr << "Failed to initialize context" << std::endl;
+            return nullptr;
+        }
+        if (!cpus.empty()) {
+            ggml_threadpool_params tpp = ggml_threadpool_params_default((int)cpus.size());
+            for (int cpu : cpus) {
+                if (cpu >= 0 && cpu < GGML_MAX_N_THREADS) tpp.cpumask[cpu] = true;
+            }
+            tpp.strict_cpu = true;
+            b->threadpool = ggml_threadpool_new(&tpp);
+            if (b->threadpool) llama_attach_threadpool(b->ctx, b->threadpool, b->threadpool);
+        }
+        b->vocab_ptr = llama_model_get_vocab(model);
+        b->batch = llama_batch_init(std::max<int>(llama_n_batch(b->ctx), b->slots), 0, 1);
+        b->n_past.assign(b->slots, 0);
+        b->logits_row.assign(b->slots, -1);
+        b->loaded_logits.resize(b->slots);
+        b->profiler = profiler;
+        return b;
+    }
+
+    ~LlamaBackend() override {
+        if (ctx) {
+            llama_batch_free(batch);
+            llama_free(ctx);
+        }
+        if (threadpool) ggml_threadpool_free(threadpool);
+        if (on_destroy) on_destroy();
+    }
+
+    // Pinned to a slice taken from `slices`, which gets it back when this backend is destroyed.
+    // With `memory`, the context's buffers are counted there until then too.
+    static std::unique_ptr<LlamaBackend> create(llama_model* model, llama_context_params params, int n_slots,
+                                                CoreSlices& slices, MemoryAccountant* memory = nullptr) {
+        auto [index, cpus] = slices.take();
+        MemoryAccountant::Allocation allocated;
+        auto build = [&, cpus = cpus] { return create(model, params, n_slots, nullptr, cpus); };
+        auto b = memory ? memory->capture(build, allocated) : build();
+        if (memory && !b) memory->release(allocated);
+        if (b) b->on_destroy = [&slices, index = index, memory, allocated] {
+            slices.release(index);
+            if (memory) memory->release(allocated);
+        };
+        else slices.release(index);
+        return b;
+    }
+
+    llama_context* context() const { return ctx; }
+
+    int n_slots() const override { return slots; }
+    int n_vocab() const override { return llama_vocab_n_tokens(vocab_ptr); }
+    const llama_vocab* vocab() const override { return vocab_ptr; }
+    llama_token eos() const override { return llama_vocab_eos(vocab_ptr); }
+
+    std::vector<llama_token> tokenize(const std::string& text, int max_tokens) override {
+        std::vector<llama_token> tokens(max_tokens);
+        int32_t n = llama_tokenize(vocab_ptr, text.c_str(), text.size(), tokens.data(), max_tokens, true, true);
+        tokens.resize(std::max(n, 0));
+        return tokens;
+    }
+
+    std::string token_to_piece(llama_token token) override {
+        char buf[128] = {0};
+        int32_t n = llama_token_to_piece(vocab_ptr, token, buf, sizeof(buf), 0, false);
+        return (n > 0) ? std::string(buf, n) : std::string();
+    }
+
+    bool prefill(int slot, const std::vector<llama_token>& tokens) override {
+        if (tokens.empty() || (int)tokens.size() >= slot_ctx) return false;
+        llama_kv_cache_seq_rm(ctx, slot, -1, -1);
+        n_past[slot] = 0;
+
+        const size_t n_batch = llama_n_batch(ctx);
+        for (size_t off = 0; off < tokens.size(); off += n_batch) {
+            size_t end = std::min(tokens.size(), off + n_batch);
+            batch.n_tokens = 0;
+            for (size_t i = off; i < end; ++i) {
+                batch_add(tokens[i], n_past[slot]++, slot, i + 1 == tokens.size());
+            }
+            if (run_batch(DecodeProfiler::PHASE_PREFILL) != 0) return false;
+        }
+        logits_row[slot] = batch.n_tokens - 1;
+        return true;
+    }
+
+    bool decode(const std::vector<StepToken>& step) override {
+        batch.n_tokens = 0;
+        for (const StepToken& st : step) {
+            if (n_past[st.slot] >= slot_ctx) return false;
+            logits_row[st.slot] = batch.n_tokens;
+            batch_add(st.token, n_past[st.slot]++, st.slot, true);
+        }
+        return run_batch(DecodeProfiler::PHASE_DECODE) == 0;
+    }
+
+    bool has_room(int slot) const override { return n_past[slot] < slot_ctx; }
+
+    float* logits(int slot) override {
+        if (logits_row[slot] < 0) return loaded_logits[slot].data();
+        return llama_get_logits_ith(ctx, logits_row[slot]);
+    }
+
+    void release(int slot) override {
+        llama_kv_cache_seq_rm(ctx, slot, -1, -1);
+        n_past[slot] = 0;
+        logits_row[slot] = -1;
+        loaded_logits[slot].clear();
+    }
+
+    bool save_slot(int slot, SlotSnapshot& out) override {
+        out.kv.resize(llama_state_seq_get_size(ctx, slot));
+        if (llama_state_seq_get_data(ctx, out.kv.data(), out.kv.size(), slot) != out.kv.size()) return false;
+        const float* last = logits(slot);
+        if (!last) return false;
+        out.logits.assign(last, last + n_vocab());
+        out.n_past = n_past[slot];
+        return true;
+    }
+
+    bool load_slot(int slot, const SlotSnapshot& in) override {
+        if (in.n_past >= slot_ctx || (int)in.logits.size() != n_vocab()) return false;
+        llama_kv_cache_seq_rm(ctx, slot, -1, -1);
+        if (llama_state_seq_set_data(ctx, in.kv.data(), in.kv.size(), slot) == 0) return false;
+        n_past[slot] = in.n_past;
+        logits_row[slot] = -1;
+        loaded_logits[slot] = in.logits;
+        return true;
+    }
+};
+
+// ---- Deterministic mock backend ----
+// No model: a small word vocabulary with logits derived from a hash of the
+// sequence so far, and sleeps standing in for compute. Decode cost is one
+// fixed weight pass per step plus a small per-sequence term, like a
+// bandwidth-bound CPU decode. Same prompt in, same reply out, on any machine.
+struct MockTiming {
+    double prefill_us_per_token = 2000.0;
+    double decode_step_us = 40000.0;
+    double decode_per_seq_us = 2500.0;
+    double handoff_us_per_token = 20.0;     // Copying a prefilled sequence's KV out or in
+
+    // speed > 1 shrinks every cost, e.g. for CI
+    MockTiming scaled(double speed) const {
+        MockTiming t = *this;
+        if (speed > 0.0) {
+            t.prefill_us_per_token /= speed;
+            t.decode_step_us /= speed;
+            t.decode_per_seq_us /= speed;
+            t.handoff_us_per_token /= speed;
+        }
+        return t;
+    }
+};
+
+class MockBackend : public DialogueBackend {
+private:
+    // Fixed token ids; words follow
+    static constexpr llama_token TOK_EOS = 0;
+    static constexpr llama_token TOK_QUOTE = 1;
+    static constexpr llama_token TOK_PERIOD = 2;
+    static constexpr llama_token TOK_COMMA = 3;
+    static constexpr llama_token TOK_BANG = 4;
+    static constexpr llama_token TOK_QUESTION = 5;
+    static constexpr llama_token FIRST_WORD = 6;
+
+    struct SlotState {
+        uint64_t hash = 0;
+        int n_prompt = 0;
+        int generated = 0;
+        int target_len = 0;   // Reply length this sequence is steering toward
+    };
+
+    int slots;
+    MockTiming timing;
+    std::vector<SlotState> state;
+    std::vector<float> logit_buf;   // n_slots x n_vocab
+
+    static const std::vector<std::string>& words() {
+        static const std::vector<std::string> w = {
+            "the", "you", "I", "a", "to", "and", "of", "is", "it", "that", "not", "here",
+            "gate", "guard", "ale", "room", "night", "road", "king", "court", "coin", "trade",
+            "stranger", "friend", "traveler", "sword", "watch", "duty", "scroll", "record",
+            "welcome", "careful", "trust", "state", "business", "enter", "leave", "wait",
+            "closed", "open", "late", "long", "quiet", "dark", "warm", "cold", "old", "new",
+            "may", "must", "will", "should", "perhaps", "indeed", "well", "yes", "no", "now",
+            "your", "my", "our", "their", "this", "those", "what", "why", "where", "when",
+            "see", "know", "seen", "heard", "told", "ask", "keep", "bring", "need", "want",
+            "castle", "tavern", "inn", "dynasty", "lord", "lady", "majesty", "honor", "oath",
+            "please", "sir", "madam", "fool", "bah", "hmph", "whatever", "glad", "kind",
+        };
+        return w;
+    }
+
+    static uint64_t mix(uint64_t x) {
+        // splitmix64 finalizer
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    static float unit(uint64_t x) { return (mix(x) >> 40) / float(1 << 24); }
+
+    static void simulate_compute(double us) {
+        if (us > 0.0) std::this_thread::sleep_for(std::chrono::microseconds((int64_t)us));
+    }
+
+    void fill_logits(int slot) {
+        const SlotState& s = state[slot];
+        float* out = &logit_buf[(size_t)slot * n_vocab()];
+        uint64_t seed = mix(s.hash ^ (uint64_t)s.generated);
+        const int g = s.generated;
+
+        for (llama_token id = FIRST_WORD; id < n_vocab(); ++id) {
+            // Zipfian word prior plus per-step noise so greedy decoding still varies
+            out[id] = -1.1f * std::log(1.0f + (id - FIRST_WORD)) + 4.0f * unit(seed + id);
+        }
+        bool near_end = g >= s.target_len;
+        out[TOK_PERIOD] = (g > s.target_len * 6 / 10) ? 1.0f + 4.0f * unit(seed + TOK_PERIOD) : -3.0f;
+        out[TOK_COMMA] = -2.5f + 4.0f * unit(seed + TOK_COMMA);
+        out[TOK_BANG] = -4.0f + 4.0f * unit(seed + TOK_BANG);
+        out[TOK_QUESTION] = -4.0f + 4.0f * unit(seed + TOK_QUESTION);
+        out[TOK_QUOTE] = near_end ? 12.0f : -10.0f;
+        out[TOK_EOS] = (g >= s.target_len + 4) ? 14.0f : -10.0f;
+    }
+
+public:
+    MockBackend(int n_slots, MockTiming t = MockTiming{})
+        : slots(std::max(1, n_slots)), timing(t), state(slots) {
+        logit_buf.assign((size_t)slots * n_vocab(), 0.0f);
+    }
+
+    int n_slots() const override { return slots; }
+    int n_vocab() const override { return FIRST_WORD + (int)words().size(); }
+    const llama_vocab* vocab() const override { return nullptr; }
+    llama_token eos() const override { return TOK_EOS; }
+
+    std::vector<llama_token> tokenize(const std::string& text, int max_tokens) override {
+        std::vector<llama_token> tokens;
+        uint64_t h = 1469598103934665603ULL;  // FNV-1a over each word
+        bool in_word = false;
+        for (size_t i = 0; i <= text.size() && (int)tokens.size() < max_tokens; ++i) {
+            unsigned char c = (i < text.size()) ? text[i] : ' ';
+            if (std::isalnum(c) || c == '\'') {
+                h = (h ^ c) * 1099511628211ULL;
+                in_word = true;
+                continue;
+            }
+            if (in_word) {
+                tokens.push_back(FIRST_WORD + (llama_token)(h % words().size()));
+                h = 1469598103934665603ULL;
+                in_word = false;
+            }
+            if (c == '"') tokens.push_back(TOK_QUOTE);
+            else if (c == '.') tokens.push_back(TOK_PERIOD);
+            else if (c == ',') tokens.push_back(TOK_COMMA);
+        }
+        if ((int)tokens.size() > max_tokens) tokens.resize(max_tokens);
+        return tokens;
+    }
+
+    std::string token_to_piece(llama_token token) override {
+        switch (token) {
+            case TOK_EOS: return "";
+            case TOK_QUOTE: return "\"";
+            case TOK_PERIOD: return ".";
+            case TOK_COMMA: return ",";
+            case TOK_BANG: return "!";
+            case TOK_QUESTION: return "?";
+            default: return " " + words()[token - FIRST_WORD];
+        }
+    }
+
+    bool prefill(int slot, const std::vector<llama_token>& tokens) override {
+        if (tokens.empty()) return false;
+        simulate_compute(timing.prefill_us_per_token * tokens.size());
+        SlotState& s = state[slot];
+        s.hash = 0;
+        for (llama_token t : tokens) s.hash = mix(s.hash ^ (uint64_t)t);
+        s.n_prompt = (int)tokens.size();
+        s.generated = 0;
+        s.target_len = 20 + (int)(mix(s.hash) % 40);
+        fill_logits(slot);
+        return true;
+    }
+
+    bool decode(const std::vector<StepToken>& step) override {
+        simulate_compute(timing.decode_step_us + timing.decode_per_seq_us * step.size());
+        for (const StepToken& st : step) {
+            SlotState& s = state[st.slot];
+            s.hash = mix(s.hash ^ (uint64_t)st.token);
+            s.generated++;
+            fill_logits(st.slot);
+        }
+        return true;
+    }
+
+    bool has_room(int) const override { return true; }
+
+    float* logits(int slot) override { return &logit_buf[(size_t)slot * n_vocab()]; }
+
+    void release(int slot) override { state[slot] = SlotState{}; }
+
+    bool save_slot(int slot, SlotSnapshot& out) override {
+        simulate_compute(timing.handoff_us_per_token * state[slot].n_prompt);
+        out.kv.resize(sizeof(SlotState));
+        std::memcpy(out.kv.data(), &state[slot], sizeof(SlotState));
+        const float* row = logits(slot);
+        out.logits.assign(row, row + n_vocab());
+        out.n_past = state[slot].n_prompt + state[slot].generated;
+        return true;
+    }
+
+    bool load_slot(int slot, const SlotSnapshot& in) override {
+        if (in.kv.size() != sizeof(SlotState) || (int)in.logits.size() != n_vocab()) return false;
+        std::memcpy(&state[slot], in.kv.data(), sizeof(SlotState));
+        simulate_compute(timing.handoff_us_per_token * state[slot].n_prompt);
+        std::copy(in.logits.begin(), in.logits.end(), logits(slot));
+        return true;
+    }
+};
@@ -0,0 +1,207 @@
+// coalesce.h - Sharing one generation between identical in-flight turns
+#pragma once
+
+#include "npc.h"
+#include "turn.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <cctype>
+#include <cstdint>
+
+enum class CoalescePolicy {
+    OFF,            // Every turn generates its own reply
+    GREEDY_ONLY,    // Share only when the turn samples greedily, so its own reply would barely differ
+    ALWAYS,         // Share even when sampling would have varied the reply
+};
+
+inline bool parse_coalesce_policy(const std::string& name, CoalescePolicy& out) {
+    if (name == "off") out = CoalescePolicy::OFF;
+    else if (name == "greedy") out = CoalescePolicy::GREEDY_ONLY;
+    else if (name == "always") out = CoalescePolicy::ALWAYS;
+    else return false;
+    return true;
+}
+
+// Lower-cased, whitespace collapsed, trailing punctuation and spaces dropped,
+// so "Open the gate!" and "open the  gate" coalesce
+inline std::string normalize_utterance(const std::string& text) {
+    std::string out;
+    out.reserve(text.size());
+    for (unsigned char c : text) {
+        if (std::isspace(c)) {
+            if (!out.empty() && out.back() != ' ') out.push_back(' ');
+        } else {
+            out.push_back((char)std::tolower(c));
+        }
+    }
+    while (!out.empty() && (out.back() == ' ' || out.back() == '.' || out.back() == '!' || out.back() == '?')) out.pop_back();
+    return out;
+}
+
+// Everything that shapes the prompt and the sampling except who is asking:
+// the player's name is left out (it is substituted on the way out) and
+// recent_action only matters through the mode it selects. `history` stands
+// for the session's Zipf and repetition state, which depends only on what
+// the conversation has generated so far.
+inline std::string coalesce_key(int npc_idx, const std::string& mode, const GameState& state,
+                                const std::string& utterance,
+                                const std::vector<std::pair<std::string, std::string>>& overrides, uint64_t history) {
+    std::string key = std::to_string(npc_idx) + "|" + mode + "|" + normalize_utterance(state.relationship) +
+                      "|" + normalize_utterance(state.player_class) + "|" + std::to_string(state.player_level) +
+                      "|" + std::to_string(history) + "|" + normalize_utterance(utterance);
+    for (const auto& [k, v] : overrides) key += "|" + k + "=" + v;
+    return key;
+}
+
+// The turns riding on one leader's generation. Lock order: engine mutex,
+// then FanOut::mutex.
+class FanOut {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Follower {
+        std::string player_name;
+        std::string session_id;     // Its conversation takes the leader's generation as its own
+        std::function<void(const std::string&)> on_piece;
+        std::promise<TurnResult> promise;
+        Clock::time_point submitted;
+        std::string held;           // Tail that may still become the leader's name
+        char before = ' ';          // Leader's character just before `held`
+        double ttft_ms = 0.0;
+        bool got_piece = false;
+    };
+
+private:
+    std::string leader_name;
+    std::mutex mutex;
+    std::string streamed;           // Everything sent so far, replayed to late joiners
+    std::vector<std::unique_ptr<Follower>> followers;
+
+    static double ms_since(Clock::time_point t) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+    }
+
+    // Bytes of UTF-8 sequences count as letters, so names are not split inside accented words
+    static bool is_word(char c) {
+        unsigned char u = (unsigned char)c;
+        return std::isalnum(u) || u == '_' || u >= 0x80;
+    }
+
+    // Appends `text` to `out` with every whole-word `from` replaced by `to`;
+    // `before` is the character preceding `text`. Unless `final`, stops
+    // short of a tail that may still become a whole-word match once more
+    // text arrives. Returns how much of `text` was consumed.
+    static size_t replace_words(const std::string& text, const std::string& from, const std::string& to,
+                                char before, bool final, std::string& out) {
+        size_t pos = 0;
+        for (size_t hit; (hit = text.find(from, pos)) != std::string::npos;) {
+            size_t end = hit + from.size();
+            out.append(text, pos, hit - pos);
+            if (end == text.size() && !final) return hit;
+            char prev = hit > 0 ? text[hit - 1] : before;
+            if (!is_word(prev) && (end == text.size() || !is_word(text[end]))) {
+                out += to;
+                pos = end;
+            } else {
+                out += text[hit];
+                pos = hit + 1;
+            }
+        }
+        size_t keep = 0;
+        for (size_t k = final ? 0 : std::min(from.size() - 1, text.size() - pos); k > 0; --k) {
+            if (text.compare(text.size() - k, k, from, 0, k) == 0) {
+                keep = k;
+                break;
+            }
+        }
+        out.append(text, pos, text.size() - pos - keep);
+        return text.size() - keep;
+    }
+
+    static std::string replace_name(const std::string& text, const std::string& from, const std::string& to) {
+        if (from.empty() || from == to) return text;
+        std::string out;
+        replace_words(text, from, to, ' ', true, out);
+        return out;
+    }
+
+    void emit(Follower& f, const std::string& text) {
+        if (text.empty()) return;
+        if (!f.got_piece) {
+            f.got_piece = true;
+            f.ttft_ms = ms_since(f.submitted);
+        }
+        if (f.on_piece) f.on_piece(text);
+    }
+
+    // Streams `piece` with the leader's name swapped for the follower's where
+    // it stands as a whole word, holding back any tail that could still be
+    // (or end) a split name
+    void forward(Follower& f, const std::string& piece, bool final = false) {
+        if (leader_name.empty() || leader_name == f.player_name) {
+            emit(f, piece);
+            return;
+        }
+        f.held += piece;
+        std::string out;
+        size_t used = replace_words(f.held, leader_name, f.player_name, f.before, final, out);
+        if (used > 0) f.before = f.held[used - 1];
+        f.held.erase(0, used);
+        emit(f, out);
+    }
+
+public:
+    const std::string key;
+    const int max_followers;
+
+    FanOut(std::string k, std::string leader, int max_fanout)
+        : leader_name(std::move(leader)), key(std::move(k)), max_followers(max_fanout) {}
+
+    // Followers are only added under the engine mutex, so full() then join() is safe there
+    bool full() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (int)followers.size() >= max_followers;
+    }
+
+    void join(std::unique_ptr<Follower> f) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!streamed.empty()) forward(*f, streamed);
+        followers.push_back(std::move(f));
+    }
+
+    // Followers' conversations; final once the engine stops offering this group to new turns
+    std::vector<std::string> follower_sessions() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::string> ids;
+        for (const auto& f : followers) ids.push_back(f->session_id);
+        return ids;
+    }
+
+    // Called on the leader's worker thread for every sampled piece
+    void publish(const std::string& piece) {
+        std::lock_guard<std::mutex> lock(mutex);
+        streamed += piece;
+        for (auto& f : followers) forward(*f, piece);
+    }
+
+    // Hands each follower a copy of the leader's result; returns how many
+    int complete(const TurnResult& leader) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& f : followers) {
+            forward(*f, std::string(), true);
+            TurnResult r = leader;
+            r.text = replace_name(leader.text, leader_name, f->player_name);
+            r.coalesced = true;
+            r.queue_ms = 0.0;
+            r.ttft_ms = f->ttft_ms;
+            r.total_ms = ms_since(f->submitted);
+            f->promise.set_value(std::move(r));
+        }
+        return (int)followers.size();
+    }
+};
@@ -0,0 +1,292 @@
+// corpusstats.h - Offline token frequency counts over text corpora, saved as a rank file for ZipfAccelerator
+#pragma once
+
+#include "llama.h"
+#include "llama-vocab.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define CORPUS_SHARD_MB 8           // Work unit handed to a thread; cut at the next newline
+#define CORPUS_LINE_TOKENS 4096     // Initial per-thread token buffer, grown for longer lines
+#define CORPUS_FIT_RANKS 1000       // Ranks used to fit the Zipf exponent in the report
+#define TOKEN_RANKS_MAGIC "ZIPFRNK1"
+
+// Read-only view of a whole file: mmap where available, a heap copy otherwise
+class MappedFile {
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    std::vector<char> copy;
+#endif
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (data && size) munmap((void*)data, size);
+#endif
+    }
+
+    bool open(const std::string& path, std::string& error) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0) ::close(fd);
+            error = "cannot open " + path;
+            return false;
+        }
+        size = (size_t)st.st_size;
+        if (size > 0) {
+            void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                error = "cannot map " + path;
+                return false;
+            }
+            madvise(p, size, MADV_SEQUENTIAL);
+            data = (const char*)p;
+        }
+        ::close(fd);
+        return true;
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            error = "cannot open " + path;
+            return false;
+        }
+        copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data = copy.data();
+        size = copy.size();
+        return true;
+#endif
+    }
+
+    std::string_view view() const { return std::string_view(data, size); }
+};
+
+// Identifies a vocabulary so a rank file built for one model is not loaded into another
+inline uint64_t vocab_fingerprint(const llama_vocab* vocab) {
+    uint64_t h = 1469598103934665603ull;    // FNV-1a
+    for (llama_token id = 0; id < (llama_token)vocab->n_tokens(); ++id) {
+        for (const char* p = vocab->token_get_text(id); *p; ++p) h = (h ^ (uint8_t)*p) * 1099511628211ull;
+        h = (h ^ 0xFF) * 1099511628211ull;
+    }
+    return h;
+}
+
+// On disk: magic, n_vocab (u32), reserved (u32), vocab fingerprint (u64),
+// total tokens (u64), rank order (i32 x n_vocab), counts (u64 x n_vocab);
+// host byte order.
+struct TokenRanks {
+    uint64_t vocab_hash = 0;
+    uint64_t total_tokens = 0;
+    std::vector<llama_token> order;     // Every token id, most frequent first
+    std::vector<uint64_t> counts;       // Indexed by token id
+
+    bool save(const std::string& path, std::string& error) const {
+        std::ofstream out(path, std::ios::binary);
+        uint32_t n_vocab = (uint32_t)order.size();
+        uint32_t reserved = 0;
+        out.write(TOKEN_RANKS_MAGIC, 8);
+        out.write((const char*)&n_vocab, sizeof(n_vocab));
+        out.write((const char*)&reserved, sizeof(reserved));
+        out.write((const char*)&vocab_hash, sizeof(vocab_hash));
+        out.write((const char*)&total_tokens, sizeof(total_tokens));
+        out.write((const char*)order.data(), order.size() * sizeof(llama_token));
+        out.write((const char*)counts.data(), counts.size() * sizeof(uint64_t));
+        if (!out) error = "cannot write " + path;
+        return (bool)out;
+    }
+
+    // Rejects files built for a different vocabulary
+    bool load(const std::string& path, const llama_vocab* vocab, std::string& error) {
+        std::ifstream in(path, std::ios::binary);
+        char magic[8] = {0};
+        uint32_t n_vocab = 0, reserved = 0;
+        in.read(magic, 8);
+        in.read((char*)&n_vocab, sizeof(n_vocab));
+        in.read((char*)&reserved, sizeof(reserved));
+        in.read((char*)&vocab_hash, sizeof(vocab_hash));
+        in.read((char*)&total_tokens, sizeof(total_tokens));
+        if (!in || std::memcmp(magic, TOKEN_RANKS_MAGIC, 8) != 0) {
+            error = path + ": not a token rank file";
+            return false;
+        }
+        if (n_vocab != vocab->n_tokens() || vocab_hash != vocab_fingerprint(vocab)) {
+            error = path + ": built for a different vocabulary";
+            return false;
+        }
+        order.resize(n_vocab);
+        counts.resize(n_vocab);
+        in.read((char*)order.data(), order.size() * sizeof(llama_token));
+        in.read((char*)counts.data(), counts.size() * sizeof(uint64_t));
+        if (!in) {
+            error = path + ": truncated";
+            return false;
+        }
+
+        // A valid order is a permutation of the vocabulary
+        std::vector<uint8_t> seen(n_vocab, 0);
+        for (llama_token t : order) {
+            if (t < 0 || (uint32_t)t >= n_vocab || seen[t]++) {
+                error = path + ": corrupt rank order";
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Counts tokens over corpus files. Files are mapped, cut into newline-aligned
+// shards, and threads pull shards from a shared index into private count
+// arrays that are summed at the end, so the hot loop takes no locks.
+// Each line is tokenized on its own, the way a single utterance would be.
+class CorpusStatsBuilder {
+private:
+    struct Shard {
+        size_t file;
+        size_t begin;
+        size_t end;
+    };
+
+    const llama_vocab* vocab;
+    int n_threads;
+
+    static std::vector<Shard> make_shards(const std::vector<std::unique_ptr<MappedFile>>& files) {
+        const size_t shard_bytes = (size_t)CORPUS_SHARD_MB << 20;
+        std::vector<Shard> shards;
+        for (size_t f = 0; f < files.size(); ++f) {
+            std::string_view text = files[f]->view();
+            for (size_t pos = 0; pos < text.size();) {
+                size_t end = std::min(text.size(), pos + shard_bytes);
+                size_t nl = (end < text.size()) ? text.find('\n', end) : std::string_view::npos;
+                end = (nl == std::string_view::npos) ? text.size() : nl + 1;
+                shards.push_back({ f, pos, end });
+                pos = end;
+            }
+        }
+        return shards;
+    }
+
+    static void count_shard(const llama_vocab* vocab, std::string_view text,
+                            std::vector<llama_token>& buf, std::vector<uint64_t>& counts) {
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t nl = text.find('\n', pos);
+            if (nl == std::string_view::npos) nl = text.size();
+            std::string_view line = text.substr(pos, nl - pos);
+            pos = nl + 1;
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            if (line.empty()) continue;
+
+            int32_t n = llama_tokenize(vocab, line.data(), (int32_t)line.size(), buf.data(), (int32_t)buf.size(), false, false);
+            if (n < 0) {
+                buf.resize(-n);
+                n = llama_tokenize(vocab, line.data(), (int32_t)line.size(), buf.data(), (int32_t)buf.size(), false, false);
+            }
+            for (int32_t k = 0; k < n; ++k) counts[buf[k]]++;
+        }
+    }
+
+    // Least-squares slope of log(count) against log(rank) over the top ranks
+    static double fit_zipf_exponent(const TokenRanks& ranks) {
+        double sx = 0, sy = 0, sxx = 0, sxy = 0;
+        int n = 0;
+        for (size_t r = 0; r < std::min<size_t>(CORPUS_FIT_RANKS, ranks.order.size()); ++r) {
+            uint64_t c = ranks.counts[ranks.order[r]];
+            if (c == 0) break;
+            double x = std::log(r + 1.0), y = std::log((double)c);
+            sx += x; sy += y; sxx += x * x; sxy += x * y;
+            n++;
+        }
+        if (n < 2) return 0.0;
+        return -(n * sxy - sx * sy) / (n * sxx - sx * sx);
+    }
+
+public:
+    CorpusStatsBuilder(const llama_vocab* v, int threads) : vocab(v), n_threads(std::max(1, threads)) {}
+
+    bool run(const std::vector<std::string>& paths, TokenRanks& ranks, std::ostream& out, std::string& error) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::unique_ptr<MappedFile>> files;
+        size_t total_bytes = 0;
+        for (const std::string& path : paths) {
+            files.push_back(std::make_unique<MappedFile>());
+            if (!files.back()->open(path, error)) return false;
+            total_bytes += files.back()->view().size();
+        }
+        std::vector<Shard> shards = make_shards(files);
+        const size_t n_vocab = vocab->n_tokens();
+        out << "Counting tokens in " << files.size() << " file(s), " << std::fixed << std::setprecision(1)
+            << total_bytes / 1048576.0 << " MiB, " << shards.size() << " shard(s) on " << n_threads << " thread(s)\n";
+
+        std::atomic<size_t> next_shard{0};
+        std::vector<std::vector<uint64_t>> thread_counts(n_threads);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < n_threads; ++t) {
+            threads.emplace_back([&, t] {
+                std::vector<uint64_t>& counts = thread_counts[t];
+                counts.assign(n_vocab, 0);
+                std::vector<llama_token> buf(CORPUS_LINE_TOKENS);
+                size_t i;
+                while ((i = next_shard.fetch_add(1)) < shards.size()) {
+                    const Shard& s = shards[i];
+                    count_shard(vocab, files[s.file]->view().substr(s.begin, s.end - s.begin), buf, counts);
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+
+        ranks.vocab_hash = vocab_fingerprint(vocab);
+        ranks.counts.assign(n_vocab, 0);
+        for (const auto& counts : thread_counts) {
+            for (size_t id = 0; id < n_vocab; ++id) ranks.counts[id] += counts[id];
+        }
+        ranks.total_tokens = std::accumulate(ranks.counts.begin(), ranks.counts.end(), (uint64_t)0);
+
+        // Unseen tokens keep their merge-score order behind every seen one
+        ranks.order.resize(n_vocab);
+        std::iota(ranks.order.begin(), ranks.order.end(), 0);
+        std::sort(ranks.order.begin(), ranks.order.end(), [&](llama_token a, llama_token b) {
+            if (ranks.counts[a] != ranks.counts[b]) return ranks.counts[a] > ranks.counts[b];
+            return vocab->token_get_score(a) > vocab->token_get_score(b);
+        });
+
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        size_t distinct = std::count_if(ranks.counts.begin(), ranks.counts.end(), [](uint64_t c) { return c > 0; });
+        out << "  " << ranks.total_tokens << " tokens, " << distinct << " of " << n_vocab << " distinct, "
+            << std::setprecision(1) << secs << " s (" << total_bytes / 1048576.0 / std::max(secs, 1e-9) << " MiB/s)\n";
+        out << "  fitted Zipf exponent over top " << CORPUS_FIT_RANKS << " ranks: "
+            << std::setprecision(2) << fit_zipf_exponent(ranks) << "\n  top tokens:";
+        for (size_t r = 0; r < std::min<size_t>(10, distinct); ++r) {
+            out << " '" << vocab->token_get_text(ranks.order[r]) << "'";
+        }
+        out << "\n";
+        return true;
+    }
+};
@@ -0,0 +1,1109 @@
+// engine.h - Multi-session dialogue engine: request queue, slot scheduler, per-session sampling state
+#pragma once
+
+#include "llama.h"
+#include "zipf.h"
+#include "npc.h"
+#include "backend.h"
+#include "memstats.h"
+#include "sampling.h"
+#include "textstream.h"
+#include "turn.h"
+#include "coalesce.h"
+#include "tokenstats.h"
+#include "tenants.h"
+#include "intents.h"
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <optional>
+#include <random>
+
+#define ENGINE_MAX_SESSIONS 4096    // Idle conversations kept before LRU eviction
+#define SHADOW_TOPK 10              // Leading candidates compared in shadow mode
+#define SHADOW_PROB_TOL 1e-4        // Probability difference counted as a divergence
+#define ENGINE_HANDOFF_DEPTH 2      // Prefilled turns allowed to wait per decode worker
+#define ENGINE_TTFT_WINDOW_SEC 5.0  // Recent TTFT reported in EngineStats covers this long
+
+struct EngineConfig {
+    int n_workers = 1;          // Backends at start(), each on its own thread; see add_worker()/retire_worker()
+    int slots_per_worker = 1;   // Sequences decoded together per backend
+    bool learn_token_stats = false; // Bias every session by the tokens all sessions have been using (opt-in)
+    CoalescePolicy coalesce = CoalescePolicy::GREEDY_ONLY;
+    int coalesce_max_fanout = 16;   // Followers sharing one generation before a new one starts
+    bool fast_sampling = false;     // Trim to TOP_CAND candidates before the sampler chain
+    double shadow_fraction = 0.0;   // Steps also sampled by the reference path and compared
+    int max_batch = 0;              // Sequences per decode step, most urgent first; 0 = every active slot
+    double pace_lead_sec = 1.5;     // Paced sequences this far ahead of their display sit out decode steps
+    int prefill_workers = 0;        // Backends that only prefill and hand the KV to decode workers; 0 = workers prefill their own turns
+    bool scripted_replies = false;  // Answer routine lines from authored intents (intents.h) without generating
+    double intent_confidence = INTENT_DEFAULT_CONFIDENCE;  // Lower-scoring lines are generated
+};
+
+// Shadow mode: the configured sampling path against the reference path on the same logits
+struct ShadowStats {
+    uint64_t steps = 0;
+    uint64_t token_diffs = 0;       // Chose a different token
+    uint64_t topk_diffs = 0;        // Different leading SHADOW_TOPK candidates
+    uint64_t prob_diffs = 0;        // A shared candidate's probability off by more than SHADOW_PROB_TOL
+    double max_prob_diff = 0.0;
+    double path_us = 0.0;           // Time in the configured path on shadowed steps
+    double reference_us = 0.0;      // Time in the reference path on the same steps
+};
+
+struct EngineStats {
+    uint64_t submitted = 0;
+    uint64_t completed = 0;
+    uint64_t tokens = 0;
+    uint64_t coalesced = 0;     // Turns answered by another turn's generation
+    uint64_t paced_skips = 0;   // Slot-steps skipped because the display was far behind
+    uint64_t handoffs = 0;      // Prefilled sequences moved from a prefill worker to a decode worker
+    uint64_t handoff_bytes = 0;
+    double handoff_ms = 0.0;    // Copying state out of and into contexts
+    uint64_t scripted = 0;      // Turns answered from authored intents
+    double scripted_saved_ms = 0.0; // Mean generated turn time minus each scripted turn's, summed
+    size_t queue_depth = 0;
+    int active = 0;
+    int workers = 0;            // Decode workers not retiring
+    int draining = 0;           // Retiring workers whose backend is not freed yet
+    double ttft_p95_ms = 0.0;   // Over turns whose first token came in the last ENGINE_TTFT_WINDOW_SEC
+    ShadowStats shadow;
+};
+
+// Each worker owns one backend and batches one decode step across all its
+// active slots. New turns are admitted into free slots between steps, so a
+// long prefill delays the next step of every other sequence on that worker.
+// With prefill_workers > 0, dedicated prefill backends take turns off the
+// queue instead and hand each prefilled sequence to a decode worker by state
+// copy, so decode steps never wait behind a prompt.
+class DialogueEngine {
+public:
+    using BackendFactory = std::function<std::unique_ptr<DialogueBackend>()>;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // One conversation's state between turns; rank tables are shared with zipf_prototype
+    struct Session {
+        ZipfAccelerator zipf;
+        bool busy = false;          // A turn for this conversation is in flight
+        int following = 0;          // Coalesced turns waiting on another conversation's generation
+        uint64_t history = 0;       // Hash of every token generated so far; equal histories sample alike
+        std::vector<std::pair<std::string, size_t>> footprint;  // Zipf table sizes when last idle; read by session_memory()
+        Clock::time_point last_used;
+    };
+
+    struct PendingTurn {
+        TurnRequest request;
+        std::promise<TurnResult> promise;
+        Clock::time_point submitted;
+        std::shared_ptr<FanOut> fanout;     // Set when identical turns may join this one
+    };
+
+    // A turn occupying one backend slot
+    struct Sequence {
+        bool active = false;
+        PendingTurn turn;
+        Session* session = nullptr;
+        SamplingConfig sampling;
+        llama_sampler* chain = nullptr;
+        std::vector<llama_token> tokens;
+        std::vector<int> token_counts;      // Per token id, over `tokens`; sized n_vocab on first use
+        std::vector<llama_token> seen;      // Distinct ids in `tokens`, kept as they are appended
+        ReplyStream reply;          // Cleaned text, built as pieces arrive
+        int min_tokens = 0;
+        int max_tokens = 0;
+        Clock::time_point display_done;     // When the display will have shown every piece so far
+        TurnResult result;
+    };
+
+    struct Worker {
+        std::unique_ptr<DialogueBackend> backend;
+        std::vector<Sequence> seqs;
+        std::vector<llama_token_data> candidates;
+        std::vector<llama_token_data> shadow_candidates;
+        std::vector<float> shadow_logits;
+        std::minstd_rand shadow_rng;
+        TokenStats::Slot* stats = nullptr;
+        int id = 0;
+        bool retiring = false;      // Guarded by `mutex`: finish what is active, admit nothing new
+        bool exited = false;        // Guarded by `mutex`: the thread has left worker_loop()
+        std::thread thread;
+    };
+
+    // A prefilled turn waiting for a decode slot
+    struct Handoff {
+        Sequence seq;
+        SlotSnapshot kv;
+    };
+
+    BackendFactory factory;
+    BackendFactory prefill_factory;
+    EngineConfig config;
+    ZipfAccelerator zipf_prototype;   // Initialized once; each new session copies it and shares its rank tables
+    std::vector<llama_token> token_ranks;   // Corpus frequency order; empty = tokenizer scores
+    std::unique_ptr<TokenStats> learned;    // Shared across workers and sessions
+    std::unique_ptr<ScriptedResponder> scripted;    // Set when config.scripted_replies
+    SamplingProfiles profiles;
+    bool has_vocab = false;
+    int n_vocab = 0;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::unique_ptr<Worker>> prefillers;
+    std::vector<TokenStats::Slot*> spare_stats;    // From reaped workers, reused by new ones
+    int next_worker_id = 0;
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<PendingTurn> queue;
+    std::deque<Handoff> handoffs;
+    TenantTable tenants;
+    int prefilling = 0;         // Turns a prefill worker has taken but not yet handed off
+    std::unordered_map<std::string, std::unique_ptr<Session>> sessions;
+    std::unordered_map<std::string, std::shared_ptr<FanOut>> fanouts;  // In-flight leaders by coalesce key
+    bool stopping = false;
+    double mean_generated_ms = 0.0;     // Moving average of generated turns' total_ms
+
+    std::atomic<uint64_t> n_submitted{0};
+    std::atomic<uint64_t> n_completed{0};
+    std::atomic<uint64_t> n_tokens{0};
+    std::atomic<uint64_t> n_coalesced{0};
+    std::atomic<uint64_t> n_paced_skips{0};
+    std::atomic<uint64_t> n_handoffs{0};
+    std::atomic<uint64_t> n_handoff_bytes{0};
+    std::atomic<uint64_t> handoff_us{0};
+    std::atomic<uint64_t> n_scripted{0};
+    std::atomic<uint64_t> scripted_saved_us{0};
+    std::atomic<bool> unpaced{false};       // Set by stop() so draining ignores display pacing
+    std::atomic<int> n_active{0};
+    mutable std::mutex shadow_mutex;
+    ShadowStats shadow_totals;
+    mutable std::mutex ttft_mutex;
+    std::deque<std::pair<Clock::time_point, double>> recent_ttft;
+
+    static Clock::duration ttft_window() {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(ENGINE_TTFT_WINDOW_SEC));
+    }
+
+    static double ms_since(Clock::time_point t) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+    }
+
+    static llama_sampler* make_chain(const SamplingConfig& cfg) {
+        llama_sampler_chain_params chain_params = llama_sampler_chain_default_params();
+        llama_sampler* chain = llama_sampler_chain_init(chain_params);
+        llama_sampler_chain_add(chain, llama_sampler_init_top_k(cfg.top_k));
+        llama_sampler_chain_add(chain, llama_sampler_init_top_p(cfg.top_p, 1));
+        llama_sampler_chain_add(chain, llama_sampler_init_temp(cfg.temp));
+        llama_sampler_chain_add(chain, cfg.greedy ? llama_sampler_init_greedy() : llama_sampler_init_dist(cfg.seed));
+        return chain;
+    }
+
+    // Caller holds the lock
+    Session* find_session_locked(const std::string& id) {
+        auto it = sessions.find(id);
+        if (it == sessions.end()) {
+            if (sessions.size() >= ENGINE_MAX_SESSIONS) evict_idle_session();
+            auto session = std::make_unique<Session>();
+            if (has_vocab) session->zipf = zipf_prototype;
+            session->footprint = session->zipf.memory_footprint();
+            it = sessions.emplace(id, std::move(session)).first;
+        }
+        it->second->last_used = Clock::now();
+        return it->second.get();
+    }
+
+    // Caller holds the lock
+    Session* acquire_session(const std::string& id) {
+        Session* session = find_session_locked(id);
+        session->busy = true;
+        return session;
+    }
+
+    void evict_idle_session() {
+        auto oldest = sessions.end();
+        for (auto it = sessions.begin(); it != sessions.end(); ++it) {
+            if (it->second->busy || it->second->following) continue;
+            if (oldest == sessions.end() || it->second->last_used < oldest->second->last_used) oldest = it;
+        }
+        if (oldest != sessions.end()) sessions.erase(oldest);
+    }
+
+    // Generating, or waiting on a generation it coalesced into
+    bool session_busy(const std::string& id) const {
+        auto it = sessions.find(id);
+        return it != sessions.end() && (it->second->busy || it->second->following > 0);
+    }
+
+    // Folds a turn's tokens into a conversation's history hash
+    static uint64_t extend_history(uint64_t history, const std::vector<llama_token>& tokens) {
+        for (llama_token t : tokens) history = (history ^ (uint32_t)t) * 1099511628211ULL;
+        return (history ^ 0xFFFFFFFFULL) * 1099511628211ULL;   // Turn boundary
+    }
+
+    // A turn of this conversation is queued, prefilling or generating
+    bool conversation_pending_locked(const std::string& id) const {
+        if (session_busy(id)) return true;
+        return std::any_of(queue.begin(), queue.end(), [&](const PendingTurn& p) { return p.request.session_id == id; });
+    }
+
+    // Answers the turn from an authored template when the line is routine,
+    // the NPC has a template for its current mode and nothing earlier in the
+    // conversation is still queued or generating (the reply would overtake it).
+    // Zipf session state is left alone: no tokens were generated.
+    bool answer_scripted(PendingTurn& turn, const NPCProfile& npc, const std::string& mode_name) {
+        const TurnRequest& req = turn.request;
+        IntentMatch m = scripted->classify(req.npc_idx, req.utterance);
+        if (!ScriptedResponder::accept(m, config.intent_confidence)) return false;
+        std::string text = ScriptedResponder::render(m, mode_name, npc, req.state, n_submitted.load());
+        if (text.empty()) return false;
+
+        double expected_ms;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (conversation_pending_locked(req.session_id)) return false;
+            expected_ms = mean_generated_ms;
+        }
+
+        if (req.on_piece) req.on_piece(text);
+        TurnResult r;
+        r.text = std::move(text);
+        r.mode = mode_name;
+        r.intent = m.intent->name;
+        r.stop = StopReason::SCRIPTED;
+        r.ttft_ms = r.total_ms = ms_since(turn.submitted);
+        n_scripted++;
+        n_completed++;
+        if (expected_ms > r.total_ms) scripted_saved_us += (uint64_t)((expected_ms - r.total_ms) * 1000.0);
+        turn.promise.set_value(std::move(r));
+        return true;
+    }
+
+    // Pop queued turns into this worker's free slots (oldest first, skipping
+    // conversations that already have a turn in flight)
+    std::vector<std::pair<int, PendingTurn>> take_admissions(Worker& w) {
+        std::vector<std::pair<int, PendingTurn>> admitted;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (w.retiring) return admitted;
+        for (int slot = 0; slot < (int)w.seqs.size() && !queue.empty(); ++slot) {
+            if (w.seqs[slot].active) continue;
+            auto it = pick_admissible_locked();
+            if (it == queue.end()) break;
+            w.seqs[slot].active = true;
+            w.seqs[slot].session = acquire_session(it->request.session_id);
+            tenants.on_admit(TenantTable::name_of(it->request.tenant));
+            admitted.emplace_back(slot, std::move(*it));
+            queue.erase(it);
+        }
+        return admitted;
+    }
+
+    // The next turn to admit: among turns whose conversation is idle and
+    // whose tenant is under its KV quota, the oldest of the tenant furthest
+    // behind in virtual time (see TenantTable)
+    std::deque<PendingTurn>::iterator pick_admissible_locked() {
+        const int slots = total_slots_locked();
+        auto best = queue.end();
+        double best_vtime = 0.0;
+        for (auto it = queue.begin(); it != queue.end(); ++it) {
+            const std::string& tenant = TenantTable::name_of(it->request.tenant);
+            if (session_busy(it->request.session_id) || !tenants.can_admit(tenant, slots)) continue;
+            double v = tenants.vtime(tenant);
+            if (best == queue.end() || v < best_vtime) {
+                best = it;
+                best_vtime = v;
+            }
+        }
+        return best;
+    }
+
+    bool has_admissible_locked() const {
+        const int slots = total_slots_locked();
+        for (const auto& p : queue) {
+            if (!session_busy(p.request.session_id) && tenants.can_admit(TenantTable::name_of(p.request.tenant), slots)) return true;
+        }
+        return false;
+    }
+
+    // Whether a decode worker with a free slot has something to start
+    bool can_admit_locked() const {
+        return prefillers.empty() ? has_admissible_locked() : !handoffs.empty();
+    }
+
+    // Stopping and nothing left anywhere between submit() and a decode slot
+    bool drained_locked() const {
+        return stopping && queue.empty() && handoffs.empty() && prefilling == 0;
+    }
+
+    // Move waiting prefilled turns into this worker's free slots; returns
+    // the state each slot still has to load
+    std::vector<std::pair<int, SlotSnapshot>> take_handoffs(Worker& w) {
+        std::vector<std::pair<int, SlotSnapshot>> taken;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int slot = 0; slot < (int)w.seqs.size() && !handoffs.empty() && !w.retiring; ++slot) {
+                Sequence& s = w.seqs[slot];
+                if (s.active) continue;
+                if (s.chain) llama_sampler_free(s.chain);
+                s = std::move(handoffs.front().seq);
+                handoffs.front().seq.chain = nullptr;
+                taken.emplace_back(slot, std::move(handoffs.front().kv));
+                handoffs.pop_front();
+            }
+        }
+        if (!taken.empty()) cv.notify_all();    // Prefill workers may have been waiting for room
+        return taken;
+    }
+
+    // Everything up to the first sampled token; false if the turn already
+    // finished with an error
+    bool prefill_sequence(Worker& w, int slot, PendingTurn&& turn) {
+        Sequence& s = w.seqs[slot];
+        s.turn = std::move(turn);
+        if ((int)s.token_counts.size() != n_vocab) s.token_counts.assign(n_vocab, 0);
+        for (llama_token t : s.seen) s.token_counts[t] = 0;
+        s.seen.clear();
+        s.tokens.clear();
+        s.reply.reset(s.turn.request.state.player_name);
+        s.display_done = Clock::time_point{};
+        s.result = TurnResult{};
+        s.result.queue_ms = ms_since(s.turn.submitted);
+        n_active++;
+
+        const TurnRequest& req = s.turn.request;
+        const NPCProfile& npc = NPCS[std::clamp(req.npc_idx, 0, (int)NPCS.size() - 1)];
+        std::string mode_name = pick_mode_for_npc(npc, req.state, req.utterance);
+        const PersonalityMode* mode = get_mode_by_name(mode_name);
+        s.result.mode = mode_name;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            s.sampling = profiles.resolve(npc.name, mode_name);
+        }
+        for (const auto& [key, value] : req.sampling_overrides) s.sampling.set(key, value);
+
+        // Update Zipf context for this turn
+        if (has_vocab) s.session->zipf.update_context(npc.name, mode_name, w.backend->vocab());
+        s.session->zipf.set_bias_strength(s.sampling.zipf_strength);
+
+        std::string full_prompt = inject_prompt_context(npc, *mode, req.state, req.utterance);
+        std::vector<llama_token> prompt_tokens = w.backend->tokenize(full_prompt, DEFAULT_MAX_TOKENS);
+        if (prompt_tokens.empty()) {
+            s.result.error = "Tokenization failed";
+            finish(w, slot, StopReason::ERROR);
+            return false;
+        }
+        s.result.n_prompt = (int)prompt_tokens.size();
+
+        if (s.chain) llama_sampler_free(s.chain);
+        s.chain = make_chain(s.sampling);
+        s.min_tokens = s.sampling.effective_min_tokens(mode->min_tokens);
+        s.max_tokens = s.sampling.effective_max_tokens(mode->max_tokens);
+
+        if (!w.backend->prefill(slot, prompt_tokens)) {
+            s.result.error = "Error decoding prompt";
+            finish(w, slot, StopReason::ERROR);
+            return false;
+        }
+        return true;
+    }
+
+    void start_sequence(Worker& w, int slot, PendingTurn&& turn) {
+        if (prefill_sequence(w, slot, std::move(turn))) sample_next(w, slot);
+    }
+
+    // A decode worker picks up a turn a prefill worker already prefilled
+    void resume_sequence(Worker& w, int slot, SlotSnapshot&& kv) {
+        Sequence& s = w.seqs[slot];
+        auto t0 = Clock::now();
+        bool loaded = w.backend->load_slot(slot, kv);
+        handoff_us += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count();
+        if (!loaded) {
+            s.result.error = "Error loading prefilled state";
+            finish(w, slot, StopReason::ERROR);
+            return;
+        }
+        n_handoffs++;
+        n_handoff_bytes += kv.kv.size() + kv.logits.size() * sizeof(float);
+        sample_next(w, slot);
+    }
+
+    // Logits -> biases -> candidates -> sampler chain, in place on `logits`.
+    // The fast path keeps only the TOP_CAND best candidates for the chain,
+    // which is exact while 0 < top_k <= TOP_CAND.
+    llama_token_data_array sample_logits(Sequence& s, float* logits, llama_token eos, const TokenStats::Snapshot* learned_bias,
+                                         bool fast, std::vector<llama_token_data>& candidates, llama_sampler* chain) {
+        const int i = (int)s.tokens.size();
+
+        // An early EOS used to be retried until min_tokens; rule it out instead
+        if (i < s.min_tokens) logits[eos] = -INFINITY;
+
+        // Apply Zipf acceleration (biases, role/mood, etc.)
+        s.session->zipf.accelerate_logits(logits, i, s.max_tokens - i);
+
+        // Bias learned from every session's replies so far
+        if (learned_bias) {
+            for (int t = 0; t < n_vocab; ++t) logits[t] += learned_bias->bias[t] * s.sampling.zipf_strength;
+        }
+
+        for (int token_id = 0; token_id < n_vocab; token_id++) {
+            candidates[token_id] = { token_id, logits[token_id], 0.0f };
+        }
+
+        // Repetition penalty on tokens already in this reply (candidates are still indexed by id).
+        // The Zipf factor is a multiplier below 1; as a divisor it pulls positive logits down and
+        // pushes negative ones further down, whichever sign the logit has.
+        if (s.sampling.repeat_penalty > 0.0f && s.sampling.repeat_penalty < 1.0f) {
+            for (llama_token t : s.seen) {
+                llama_token_data& cand = candidates[t];
+                float penalty = 1.0f / s.session->zipf.get_repetition_penalty(t, s.token_counts[t], s.sampling.repeat_penalty);
+                cand.logit = cand.logit > 0.0f ? cand.logit / penalty : cand.logit * penalty;
+            }
+        }
+
+        size_t n_cand = (size_t)n_vocab;
+        if (fast && s.sampling.top_k > 0 && s.sampling.top_k <= TOP_CAND && TOP_CAND < n_vocab) {
+            std::nth_element(candidates.begin(), candidates.begin() + TOP_CAND, candidates.end(),
+                             [](const llama_token_data& a, const llama_token_data& b) { return a.logit > b.logit; });
+            n_cand = TOP_CAND;
+        }
+        llama_token_data_array arr = { candidates.data(), n_cand, -1, false };
+        llama_sampler_apply(chain, &arr);
+        return arr;
+    }
+
+    static llama_token selected_token(const llama_token_data_array& arr) {
+        return (arr.selected >= 0) ? arr.data[arr.selected].id : LLAMA_TOKEN_NULL;
+    }
+
+    // Both arrays come out of the chain sorted by logit, so their heads line up
+    void record_shadow(const llama_token_data_array& path, const llama_token_data_array& ref, double path_us, double ref_us) {
+        size_t k = std::min<size_t>(SHADOW_TOPK, std::min(path.size, ref.size));
+        std::vector<llama_token> a, b;
+        for (size_t j = 0; j < k; ++j) {
+            a.push_back(path.data[j].id);
+            b.push_back(ref.data[j].id);
+        }
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+
+        double max_diff = 0.0;
+        for (size_t j = 0; j < k; ++j) {
+            for (size_t m = 0; m < k; ++m) {
+                if (path.data[j].id == ref.data[m].id) max_diff = std::max(max_diff, (double)std::fabs(path.data[j].p - ref.data[m].p));
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(shadow_mutex);
+        ShadowStats& st = shadow_totals;
+        st.steps++;
+        st.token_diffs += selected_token(path) != selected_token(ref);
+        st.topk_diffs += (a != b || std::min<size_t>(SHADOW_TOPK, path.size) != std::min<size_t>(SHADOW_TOPK, ref.size));
+        st.prob_diffs += max_diff > SHADOW_PROB_TOL;
+        st.max_prob_diff = std::max(st.max_prob_diff, max_diff);
+        st.path_us += path_us;
+        st.reference_us += ref_us;
+    }
+
+    // Sample from the slot's current logits; returns false once the turn is done
+    bool sample_next(Worker& w, int slot) {
+        Sequence& s = w.seqs[slot];
+        DialogueBackend& backend = *w.backend;
+        const int i = (int)s.tokens.size();
+        const llama_token eos = backend.eos();
+        float* logits = backend.logits(slot);
+
+        // Shadowed steps keep the untouched logits and chain state for the reference run
+        const bool shadow = config.shadow_fraction > 0.0 &&
+                            std::uniform_real_distribution<double>(0.0, 1.0)(w.shadow_rng) < config.shadow_fraction;
+        llama_sampler* ref_chain = nullptr;
+        if (shadow) {
+            w.shadow_logits.assign(logits, logits + n_vocab);
+            ref_chain = llama_sampler_clone(s.chain);
+        }
+
+        llama_token next_token;
+        {
+            // Same learned bias for both runs (never blocks)
+            std::optional<TokenStats::Reader> reader;
+            if (w.stats) reader.emplace(*w.stats);
+            const TokenStats::Snapshot* learned_bias = reader ? reader->get() : nullptr;
+
+            auto t0 = Clock::now();
+            llama_token_data_array arr = sample_logits(s, logits, eos, learned_bias, config.fast_sampling, w.candidates, s.chain);
+            next_token = selected_token(arr);
+            if (shadow) {
+                auto t1 = Clock::now();
+                llama_token_data_array ref = sample_logits(s, w.shadow_logits.data(), eos, learned_bias, false, w.shadow_candidates, ref_chain);
+                auto t2 = Clock::now();
+                record_shadow(arr, ref, std::chrono::duration<double, std::micro>(t1 - t0).count(),
+                              std::chrono::duration<double, std::micro>(t2 - t1).count());
+                llama_sampler_free(ref_chain);
+            }
+        }
+
+        if (next_token == eos || next_token == LLAMA_TOKEN_NULL) {
+            finish(w, slot, StopReason::EOS);
+            return false;
+        }
+
+        s.tokens.push_back(next_token);
+        if (s.token_counts[next_token]++ == 0) s.seen.push_back(next_token);
+        llama_sampler_accept(s.chain, next_token);
+        if (w.stats) w.stats->record(next_token);
+
+        std::string token_str = backend.token_to_piece(next_token);
+        s.reply.feed(token_str);
+        if (s.turn.request.display_cps > 0.0) {
+            // The display waits whenever it has caught up with the text
+            auto now = Clock::now();
+            if (i > 0 && now > s.display_done) s.result.stall_ms += std::chrono::duration<double, std::milli>(now - s.display_done).count();
+            s.display_done = std::max(now, s.display_done) +
+                std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(token_str.size() / s.turn.request.display_cps));
+        }
+        if (i == 0) {
+            s.result.ttft_ms = ms_since(s.turn.submitted);
+            auto now = Clock::now();
+            std::lock_guard<std::mutex> lock(ttft_mutex);
+            recent_ttft.emplace_back(now, s.result.ttft_ms);
+            while (recent_ttft.front().first < now - ttft_window()) recent_ttft.pop_front();
+        }
+        n_tokens++;
+        if (s.turn.request.on_piece) s.turn.request.on_piece(token_str);
+        if (s.turn.fanout) s.turn.fanout->publish(token_str);
+
+        // Look for closing quote (natural end of dialogue)
+        if (token_str.find('"') != std::string::npos && i >= s.min_tokens) {
+            finish(w, slot, StopReason::CLOSING_QUOTE);
+            return false;
+        }
+
+        // Check for forbidden speaker cues
+        if (s.reply.stop_cue_seen()) {
+            finish(w, slot, StopReason::FORBIDDEN_SPEAKER);
+            return false;
+        }
+
+        if ((int)s.tokens.size() >= s.max_tokens) {
+            finish(w, slot, StopReason::MAX_TOKENS);
+            return false;
+        }
+        return true;
+    }
+
+    // Seconds of generated text the player has not been shown yet
+    double display_lead(const Sequence& s, Clock::time_point now) const {
+        if (s.turn.request.display_cps <= 0.0 || s.tokens.empty()) return 0.0;
+        return std::chrono::duration<double>(s.display_done - now).count();
+    }
+
+    // One batched decode step. Paced sequences far ahead of their display sit
+    // it out; the rest go in order of how soon their display runs dry, up to
+    // max_batch. Unpaced sequences count as already dry.
+    void step(Worker& w) {
+        auto now = Clock::now();
+        bool pace = !unpaced.load();
+        std::vector<std::pair<double, int>> ready;  // (lead, slot)
+        double next_due = INFINITY;
+        for (int slot = 0; slot < (int)w.seqs.size(); ++slot) {
+            if (!w.seqs[slot].active) continue;
+            double lead = display_lead(w.seqs[slot], now);
+            if (pace && lead > config.pace_lead_sec) {
+                next_due = std::min(next_due, lead - config.pace_lead_sec);
+                n_paced_skips++;
+                continue;
+            }
+            ready.emplace_back(lead, slot);
+        }
+        if (ready.empty()) {
+            // Everyone is comfortably ahead: sleep until one is due or a turn can be admitted
+            bool free_slot = std::any_of(w.seqs.begin(), w.seqs.end(), [](const Sequence& s) { return !s.active; });
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait_for(lock, std::chrono::duration<double>(next_due),
+                        [&] { return (free_slot && !w.retiring && can_admit_locked()) || stopping; });
+            return;
+        }
+        if (config.max_batch > 0 && (int)ready.size() > config.max_batch) {
+            std::partial_sort(ready.begin(), ready.begin() + config.max_batch, ready.end());
+            ready.resize(config.max_batch);
+        }
+
+        // A conversation that filled its slot's context ends there instead of failing the whole batch
+        std::vector<DialogueBackend::StepToken> batch;
+        for (const auto& [lead, slot] : ready) {
+            if (w.backend->has_room(slot)) batch.push_back({ slot, w.seqs[slot].tokens.back() });
+            else finish(w, slot, StopReason::MAX_TOKENS);
+        }
+        if (batch.empty()) return;
+
+        if (!w.backend->decode(batch)) {
+            for (const auto& st : batch) {
+                w.seqs[st.slot].result.error = "Decoding error during generation";
+                finish(w, st.slot, StopReason::ERROR);
+            }
+            return;
+        }
+        for (const auto& st : batch) sample_next(w, st.slot);
+    }
+
+    void finish(Worker& w, int slot, StopReason reason) {
+        Sequence& s = w.seqs[slot];
+        s.result.stop = reason;
+        s.result.n_tokens = (int)s.tokens.size();
+
+        // Cleaned as it streamed (partial replies survive a decode error)
+        if (s.result.error.empty() || !s.tokens.empty()) s.result.text = s.reply.finish();
+
+        // Update Zipf conversation state with generated tokens
+        s.session->zipf.record_generation(s.tokens);
+        auto footprint = s.session->zipf.memory_footprint();
+        w.backend->release(slot);
+        s.result.total_ms = ms_since(s.turn.submitted);
+
+        std::vector<Session*> following;    // Conversations that coalesced into this turn
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            s.session->busy = false;
+            s.session->history = extend_history(s.session->history, s.tokens);
+            s.session->footprint = std::move(footprint);
+            s.session->last_used = Clock::now();
+            tenants.on_finish(TenantTable::name_of(s.turn.request.tenant), s.result.n_prompt, s.result.n_tokens,
+                              s.result.queue_ms, s.result.ttft_ms);
+            if (s.result.error.empty()) {
+                mean_generated_ms = mean_generated_ms > 0.0 ? 0.95 * mean_generated_ms + 0.05 * s.result.total_ms
+                                                            : s.result.total_ms;
+            }
+            s.active = false;
+            s.session = nullptr;
+            if (s.turn.fanout) {
+                auto it = fanouts.find(s.turn.fanout->key);
+                if (it != fanouts.end() && it->second == s.turn.fanout) fanouts.erase(it);
+                // The reply is theirs too; their sessions are idle while `following`
+                for (const std::string& id : s.turn.fanout->follower_sessions()) {
+                    Session* f = sessions.at(id).get();
+                    f->zipf.record_generation(s.tokens);
+                    f->history = extend_history(f->history, s.tokens);
+                    f->footprint = f->zipf.memory_footprint();
+                    f->last_used = Clock::now();
+                    following.push_back(f);
+                }
+            }
+        }
+        n_active--;
+        n_completed++;
+        if (s.turn.fanout) {
+            n_completed += s.turn.fanout->complete(s.result);
+            s.turn.fanout.reset();
+            // Only now may their next turns start, after the reply has been delivered
+            std::lock_guard<std::mutex> lock(mutex);
+            for (Session* f : following) f->following--;
+        }
+        s.turn.promise.set_value(std::move(s.result));
+        cv.notify_all();
+    }
+
+    void worker_loop(Worker& w) {
+        while (true) {
+            if (prefillers.empty()) {
+                for (auto& [slot, turn] : take_admissions(w)) start_sequence(w, slot, std::move(turn));
+            } else {
+                for (auto& [slot, kv] : take_handoffs(w)) resume_sequence(w, slot, std::move(kv));
+            }
+
+            bool any_active = std::any_of(w.seqs.begin(), w.seqs.end(), [](const Sequence& s) { return s.active; });
+            if (!any_active) {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return w.retiring || can_admit_locked() || drained_locked(); });
+                if (w.retiring || drained_locked()) {
+                    w.exited = true;
+                    return;
+                }
+                continue;
+            }
+            step(w);
+        }
+    }
+
+    // Prefill workers take one turn at a time off the queue, run its prompt
+    // with the whole batch width, and queue the result for the decode workers.
+    // They pause while ENGINE_HANDOFF_DEPTH turns per decode worker are waiting.
+    void prefill_loop(Worker& w) {
+        while (true) {
+            PendingTurn turn;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] {
+                    size_t max_waiting = (size_t)ENGINE_HANDOFF_DEPTH * std::max(1, live_workers_locked());
+                    return (has_admissible_locked() && handoffs.size() < max_waiting) || (stopping && queue.empty());
+                });
+                if (stopping && queue.empty()) return;
+                auto it = pick_admissible_locked();
+                w.seqs[0].active = true;
+                w.seqs[0].session = acquire_session(it->request.session_id);
+                tenants.on_admit(TenantTable::name_of(it->request.tenant));
+                turn = std::move(*it);
+                queue.erase(it);
+                prefilling++;
+            }
+
+            Handoff h;
+            bool ready = prefill_sequence(w, 0, std::move(turn));
+            if (ready) {
+                auto t0 = Clock::now();
+                ready = w.backend->save_slot(0, h.kv);
+                handoff_us += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count();
+                if (!ready) {
+                    w.seqs[0].result.error = "Error saving prefilled state";
+                    finish(w, 0, StopReason::ERROR);
+                }
+            }
+            if (ready) {
+                w.backend->release(0);
+                h.seq = std::move(w.seqs[0]);
+                w.seqs[0].chain = nullptr;
+                w.seqs[0].active = false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (ready) handoffs.push_back(std::move(h));
+                prefilling--;
+            }
+            cv.notify_all();
+        }
+    }
+
+    int total_slots_locked() const {
+        int n = 0;
+        for (const auto& w : workers) n += w->retiring ? 0 : (int)w->seqs.size();
+        return n;
+    }
+
+    int live_workers_locked() const {
+        return (int)std::count_if(workers.begin(), workers.end(), [](const auto& w) { return !w->retiring; });
+    }
+
+    // A decode worker around a new backend, not yet running
+    std::unique_ptr<Worker> make_worker() {
+        auto w = std::make_unique<Worker>();
+        w->backend = factory();
+        if (!w->backend || (n_vocab && w->backend->n_vocab() != n_vocab)) return nullptr;
+        w->seqs.resize(w->backend->n_slots());
+        w->candidates.resize(w->backend->n_vocab());
+        if (config.shadow_fraction > 0.0) w->shadow_candidates.resize(w->backend->n_vocab());
+        return w;
+    }
+
+    // Caller holds the lock
+    void launch_worker_locked(std::unique_ptr<Worker> w) {
+        w->id = next_worker_id++;
+        w->shadow_rng.seed(1234 + w->id);
+        if (learned && !spare_stats.empty()) {
+            w->stats = spare_stats.back();
+            spare_stats.pop_back();
+        } else if (learned) {
+            w->stats = learned->register_thread();
+        }
+        Worker* wp = w.get();
+        workers.push_back(std::move(w));
+        wp->thread = std::thread([this, wp] { worker_loop(*wp); });
+    }
+
+public:
+    // `prefill_backend_factory` builds the prefill workers' backends; defaults to `backend_factory`
+    DialogueEngine(BackendFactory backend_factory, EngineConfig cfg, BackendFactory prefill_backend_factory = nullptr)
+        : factory(std::move(backend_factory)), prefill_factory(std::move(prefill_backend_factory)), config(cfg) {
+        if (!prefill_factory) prefill_factory = factory;
+        if (config.scripted_replies) scripted = std::make_unique<ScriptedResponder>();
+    }
+
+    ~DialogueEngine() { stop(); }
+
+    DialogueEngine(const DialogueEngine&) = delete;
+    DialogueEngine& operator=(const DialogueEngine&) = delete;
+
+    // Create every backend and start the worker threads
+    bool start() {
+        std::vector<std::unique_ptr<Worker>> initial;
+        for (int i = 0; i < std::max(1, config.n_workers); ++i) {
+            auto w = make_worker();
+            if (!w) return false;
+            if (i == 0) {
+                n_vocab = w->backend->n_vocab();
+                has_vocab = w->backend->vocab() != nullptr;
+                if (has_vocab && token_ranks.empty()) zipf_prototype.initialize(w->backend->vocab());
+                if (has_vocab && !token_ranks.empty()) zipf_prototype.initialize(w->backend->vocab(), token_ranks);
+            }
+            if (i == 0 && config.learn_token_stats) learned = std::make_unique<TokenStats>(n_vocab);
+            initial.push_back(std::move(w));
+        }
+        for (int i = 0; i < config.prefill_workers; ++i) {
+            auto p = std::make_unique<Worker>();
+            p->backend = prefill_factory();
+            if (!p->backend || p->backend->n_vocab() != n_vocab) return false;
+            p->seqs.resize(1);
+            prefillers.push_back(std::move(p));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& w : initial) launch_worker_locked(std::move(w));
+        }
+        for (auto& p : prefillers) {
+            Worker* pp = p.get();
+            pp->thread = std::thread([this, pp] { prefill_loop(*pp); });
+        }
+        if (learned) learned->start();
+        return true;
+    }
+
+    // Finish everything already queued, then join the workers
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping && workers.empty()) return;
+            stopping = true;
+            unpaced = true;
+        }
+        cv.notify_all();
+        for (auto& p : prefillers) {
+            if (p->thread.joinable()) p->thread.join();
+            for (auto& s : p->seqs) {
+                if (s.chain) llama_sampler_free(s.chain);
+            }
+        }
+        for (auto& w : workers) {
+            if (w->thread.joinable()) w->thread.join();
+            for (auto& s : w->seqs) {
+                if (s.chain) llama_sampler_free(s.chain);
+            }
+        }
+        for (auto& h : handoffs) {
+            if (h.seq.chain) llama_sampler_free(h.seq.chain);
+        }
+        handoffs.clear();
+        workers.clear();
+        prefillers.clear();
+        if (learned) learned->stop();
+    }
+
+    // Start one more decode worker on a new backend (models are shared, so
+    // this costs a context and its KV cache). False once stopping.
+    bool add_worker() {
+        reap_retired();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping || workers.empty()) return false;
+        }
+        auto w = make_worker();     // Context creation is slow; keep it outside the lock
+        if (!w) return false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) return false;
+            launch_worker_locked(std::move(w));
+        }
+        cv.notify_all();
+        return true;
+    }
+
+    // Stop admitting to the live worker with the fewest turns in flight; it
+    // finishes them and exits, and is freed by reap_retired() (also run by
+    // add/retire) or stop(). Sessions live in the engine, so conversations
+    // carry on elsewhere. Never retires the last live worker.
+    bool retire_worker() {
+        reap_retired();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Worker* pick = nullptr;
+            long pick_active = 0;
+            for (const auto& w : workers) {
+                if (w->retiring) continue;
+                long active = std::count_if(w->seqs.begin(), w->seqs.end(), [](const Sequence& s) { return s.active; });
+                if (!pick || active < pick_active) {
+                    pick = w.get();
+                    pick_active = active;
+                }
+            }
+            if (stopping || !pick || live_workers_locked() <= 1) return false;
+            pick->retiring = true;
+        }
+        cv.notify_all();
+        return true;
+    }
+
+    // Join workers that finished retiring and free their backends; call
+    // periodically while workers may be retiring (Autoscaler does each tick)
+    void reap_retired() {
+        std::vector<std::unique_ptr<Worker>> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) return;   // stop() joins everything
+            for (auto it = workers.begin(); it != workers.end();) {
+                if (!(*it)->exited) {
+                    ++it;
+                    continue;
+                }
+                if ((*it)->stats) spare_stats.push_back((*it)->stats);
+                done.push_back(std::move(*it));
+                it = workers.erase(it);
+            }
+        }
+        for (auto& w : done) {
+            w->thread.join();
+            for (auto& s : w->seqs) {
+                if (s.chain) llama_sampler_free(s.chain);
+            }
+        }
+    }
+
+    // Call before start(); see TokenRanks in corpusstats.h
+    void set_token_ranks(std::vector<llama_token> order) { token_ranks = std::move(order); }
+
+    // Takes effect from the next admitted turn
+    void set_sampling_profiles(SamplingProfiles p) {
+        std::lock_guard<std::mutex> lock(mutex);
+        profiles = std::move(p);
+    }
+
+    // Identical turns already queued or generating are answered by that
+    // generation instead of starting another one (see EngineConfig::coalesce)
+    std::future<TurnResult> submit(TurnRequest request) {
+        PendingTurn turn;
+        turn.request = std::move(request);
+        turn.submitted = Clock::now();
+        std::future<TurnResult> result = turn.promise.get_future();
+        n_submitted++;
+
+        const TurnRequest& req = turn.request;
+        const NPCProfile& npc = NPCS[std::clamp(req.npc_idx, 0, (int)NPCS.size() - 1)];
+        bool coalesce = config.coalesce != CoalescePolicy::OFF && !req.require_variety;
+        std::string mode_name;
+        if (scripted || coalesce) mode_name = pick_mode_for_npc(npc, req.state, req.utterance);
+        if (scripted && answer_scripted(turn, npc, mode_name)) return result;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (coalesce && config.coalesce == CoalescePolicy::GREEDY_ONLY) {
+                SamplingConfig sampling = profiles.resolve(npc.name, mode_name);
+                for (const auto& [k, v] : req.sampling_overrides) sampling.set(k, v);
+                coalesce = sampling.greedy;
+            }
+            // An earlier turn will change this conversation's state before this one runs
+            if (coalesce && !conversation_pending_locked(req.session_id)) {
+                auto s = sessions.find(req.session_id);
+                // Shards never share a generation
+                std::string key = TenantTable::name_of(req.tenant) + "|" +
+                                  coalesce_key(req.npc_idx, mode_name, req.state, req.utterance, req.sampling_overrides,
+                                               s == sessions.end() ? 0 : s->second->history);
+                auto it = fanouts.find(key);
+                if (it != fanouts.end() && !it->second->full()) {
+                    auto f = std::make_unique<FanOut::Follower>();
+                    f->player_name = req.state.player_name;
+                    f->session_id = req.session_id;
+                    find_session_locked(req.session_id)->following++;
+                    f->on_piece = req.on_piece;
+                    f->submitted = turn.submitted;
+                    f->promise = std::move(turn.promise);
+                    it->second->join(std::move(f));
+                    n_coalesced++;
+                    return result;
+                }
+                // First of its kind, or the current group is full: lead a new one
+                turn.fanout = std::make_shared<FanOut>(key, req.state.player_name, config.coalesce_max_fanout);
+                fanouts[key] = turn.fanout;
+            }
+            tenants.on_submit(TenantTable::name_of(req.tenant));
+            queue.push_back(std::move(turn));
+        }
+        cv.notify_all();
+        return result;
+    }
+
+    EngineStats stats() const {
+        EngineStats st;
+        st.submitted = n_submitted.load();
+        st.completed = n_completed.load();
+        st.tokens = n_tokens.load();
+        st.coalesced = n_coalesced.load();
+        st.paced_skips = n_paced_skips.load();
+        st.handoffs = n_handoffs.load();
+        st.handoff_bytes = n_handoff_bytes.load();
+        st.handoff_ms = handoff_us.load() / 1000.0;
+        st.scripted = n_scripted.load();
+        st.scripted_saved_ms = scripted_saved_us.load() / 1000.0;
+        st.active = n_active.load();
+        {
+            std::lock_guard<std::mutex> lock(shadow_mutex);
+            st.shadow = shadow_totals;
+        }
+        {
+            std::lock_guard<std::mutex> lock(ttft_mutex);
+            auto cutoff = Clock::now() - ttft_window();
+            std::vector<double> window;
+            for (const auto& [t, ms] : recent_ttft) {
+                if (t >= cutoff) window.push_back(ms);
+            }
+            if (!window.empty()) {
+                size_t k = std::min(window.size() - 1, (size_t)(0.95 * window.size()));
+                std::nth_element(window.begin(), window.begin() + k, window.end());
+                st.ttft_p95_ms = window[k];
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        st.queue_depth = queue.size();
+        st.workers = live_workers_locked();
+        st.draining = (int)workers.size() - st.workers;
+        return st;
+    }
+
+    // Decode slots on workers that are not retiring
+    int total_slots() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return total_slots_locked();
+    }
+
+    std::vector<TenantStats> tenant_stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return tenants.stats(total_slots_locked());
+    }
+
+    // Weight and KV quota for a tenant; applies to turns admitted from now on
+    void set_tenant_policy(const std::string& tenant, TenantPolicy policy) {
+        std::lock_guard<std::mutex> lock(mutex);
+        tenants.set_policy(tenant, policy);
+    }
+
+    // Per-conversation tables, each worker's candidate array and token counts,
+    // and what all of them share. Busy sessions' Zipf tables belong to their
+    // worker, so sessions report the sizes published when their last turn finished.
+    std::vector<SessionMemory> session_memory() const {
+        std::vector<SessionMemory> out;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& [id, session] : sessions) {
+            SessionMemory sm;
+            sm.label = id;
+            for (const auto& [name, bytes] : session->footprint) sm.add(name, bytes);
+            out.push_back(std::move(sm));
+        }
+        for (const auto& w : workers) {
+            SessionMemory sm;
+            sm.label = "worker " + std::to_string(w->id);
+            sm.add("candidates", vector_bytes(w->candidates));
+            sm.add("token_counts", w->seqs.size() * (size_t)n_vocab * sizeof(int));   // Slots resize theirs unlocked
+            out.push_back(std::move(sm));
+        }
+        SessionMemory shared;
+        shared.label = "shared";
+        for (const auto& [name, bytes] : zipf_prototype.shared_footprint()) shared.add(name, bytes);
+        if (learned) shared.add("learned token stats", learned->memory_bytes());
+        if (!shared.components.empty()) out.push_back(std::move(shared));
+        return out;
+    }
+};
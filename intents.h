@@ -0,0 +1,372 @@
+// intents.h - Authored intents per NPC and a lightweight classifier that answers routine lines from templates
+#pragma once
+
+#include "npc.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cctype>
+#include <cstring>
+
+#define INTENT_EMBED_DIM 256            // Hashed bag-of-words + trigram embedding width
+#define INTENT_TRIGRAM_WEIGHT 0.5f      // Character trigrams relative to whole words
+#define INTENT_KEYWORD_BOOST 0.2        // Added to an intent's similarity when one of its keywords appears
+#define INTENT_MARGIN 0.08              // Best intent must beat the runner-up by this, or the line is ambiguous
+#define INTENT_MIN_COVERAGE 0.8         // Share of a long line's content words the intent's examples must account for
+#define INTENT_SHORT_LINE 6             // Lines with fewer content words than this must be covered in full
+#define INTENT_DEFAULT_CONFIDENCE 0.6   // Below this the LLM answers
+
+// A routine thing players say to an NPC, and how the NPC answers it in each
+// mood. Templates may use {player}, {class} and {npc}. A mood with no
+// templates always goes to the LLM.
+struct AuthoredIntent {
+    std::string name;
+    std::vector<std::string> keywords;  // Whole-word phrases, lower case
+    std::vector<std::string> examples;  // Typical lines the similarity index is built from
+    std::map<std::string, std::vector<std::string>> replies;   // Mode name -> templates
+};
+
+inline const std::map<std::string, std::vector<AuthoredIntent>> NPC_INTENTS = {
+    { "Krackle", {
+        { "greeting",
+          { "hello", "hi", "hail", "greetings", "good morning", "good evening", "good day" },
+          { "hello", "hi there", "hail guard", "greetings", "good evening to you", "good morning" },
+          { { "friendly", { "Hail, {player}. Quiet watch so far. Keep it that way.",
+                            "Evening, {player}. Good to see a face that isn't causing trouble." } },
+            { "rude", { "What. Speak quickly or move along.", "Another one. State your business, {class}." } },
+            { "suspicious", { "Hold there. I don't know you, {class}. State your business at the Ramsel gate.",
+                              "Greetings yourself. Keep your hands where I can see them." } } } },
+        { "enter",
+          { "enter", "let me in", "open the gate", "pass", "go inside", "come in" },
+          { "may i enter", "let me in", "open the gate please", "can i pass", "i want to go inside the castle" },
+          { { "friendly", { "Go on through, {player}. Mind the steward, he bites harder than I do." } },
+            { "rude", { "The gate stays shut. Come back when someone important vouches for you." } },
+            { "suspicious", { "Nobody passes without business with the dynasty. Who sent you?",
+                              "Not yet. Name your business inside, and I'll decide if it's real." } } } },
+        { "directions",
+          { "where is", "which way", "how do i get", "road to", "way to" },
+          { "where is the road to the village", "which way to the market", "how do i get to the tavern", "where is the inn" },
+          { { "friendly", { "Down the hill, past the old well. Can't miss it. The Weary Traveler has the warmest fire." } },
+            { "rude", { "Down the hill. Away from my gate, that's the important part." } },
+            { "suspicious", { "Village is down the hill. Odd that you came up here to ask." } } } },
+        { "farewell",
+          { "goodbye", "bye", "farewell", "see you", "good night" },
+          { "goodbye", "farewell guard", "see you later", "good night" },
+          { { "friendly", { "Safe roads, {player}." } },
+            { "rude", { "Finally." } },
+            { "suspicious", { "Move along, then. I'll remember your face." } } } },
+        { "thanks",
+          { "thank you", "thanks", "much obliged" },
+          { "thank you", "thanks guard", "much obliged" },
+          { { "friendly", { "Just doing my duty. Go on." } },
+            { "rude", { "Don't thank me. Just don't make me regret it." } },
+            { "suspicious", { "Hm. Save your thanks. I'm still watching you." } } } },
+    } },
+    { "Mira", {
+        { "greeting",
+          { "hello", "hi", "greetings", "good morning", "good evening", "good day" },
+          { "hello", "hi there", "good evening", "greetings innkeeper", "good morning mira" },
+          { { "friendly", { "Welcome to the Weary Traveler, {player}! Sit by the fire, you look like you've earned it.",
+                            "Evening, {player}. Your usual corner is free." } },
+            { "suspicious", { "Evening. You're new. Coin first, stories later.",
+                              "Welcome, I suppose. We don't want trouble here, {class}." } },
+            { "stoic", { "Evening. Room or drink?" } } } },
+        { "room",
+          { "room", "bed", "stay the night", "lodging", "sleep" },
+          { "how much for a room", "do you have a room for the night", "i need a bed", "can i stay the night" },
+          { { "friendly", { "Five silver for the night, supper included. Top of the stairs, second door.",
+                            "For you, five silver and a hot breakfast. The room over the kitchen is warmest." } },
+            { "suspicious", { "Five silver, paid before you go up. And I lock the cellar at night." } },
+            { "stoic", { "Five silver. Pay now. Second door upstairs." } } } },
+        { "drink",
+          { "ale", "beer", "mead", "drink", "wine" },
+          { "an ale please", "can i get a drink", "what do you have to drink", "a mug of mead" },
+          { { "friendly", { "One ale, coming right up. Brewed it myself last week." } },
+            { "suspicious", { "Two copper. Show me the coin and I'll pour." } },
+            { "stoic", { "Two copper. Here." } } } },
+        { "farewell",
+          { "goodbye", "bye", "farewell", "see you", "good night" },
+          { "goodbye", "good night mira", "see you tomorrow", "farewell" },
+          { { "friendly", { "Safe travels, {player}. The door's always open." } },
+            { "suspicious", { "Mind the step on your way out." } },
+            { "stoic", { "Good night." } } } },
+        { "thanks",
+          { "thank you", "thanks", "much obliged" },
+          { "thank you", "thanks mira", "much obliged" },
+          { { "friendly", { "Don't mention it, love." } },
+            { "suspicious", { "Mm. Just pay your tab." } },
+            { "stoic", { "Welcome." } } } },
+    } },
+    { "Feylan", {
+        { "greeting",
+          { "hello", "hi", "greetings", "good morning", "good evening", "good day" },
+          { "hello", "hi there", "greetings scribe", "good morning feylan", "good day" },
+          { { "deferential", { "Oh! Good day, honored {class}. How may this humble scribe serve you?",
+                               "Greetings, my lord {player}. Forgive the ink, I was copying the registers." } },
+            { "friendly", { "Hello, {player}! Come in, mind the scrolls on the floor." } },
+            { "stoic", { "Good day. The court office is open." } } } },
+        { "records",
+          { "records", "archive", "register", "look up", "scrolls" },
+          { "can you check the records", "i need to see the archive", "look up a name in the register", "do you keep the court records" },
+          { { "deferential", { "Of course, of course! Every writ since the founding is in the east archive. Which name shall I find for you?" } },
+            { "friendly", { "The records? Happily. Give me a name and a year and I'll dig it out." } },
+            { "stoic", { "Records are in the east archive. Give me the name and year." } } } },
+        { "directions",
+          { "where is", "which way", "how do i get", "way to" },
+          { "where is the throne room", "which way to the court", "how do i get to the great hall", "where is the steward" },
+          { { "deferential", { "Please, allow me: through the gallery, left at the tapestry of the first queen, then up the stair." } },
+            { "friendly", { "Through the gallery, left at the big tapestry, up the stair. You'll hear the steward before you see him." } },
+            { "stoic", { "Through the gallery, left, then up the stair." } } } },
+        { "farewell",
+          { "goodbye", "bye", "farewell", "see you" },
+          { "goodbye", "farewell scribe", "see you later" },
+          { { "deferential", { "Farewell, honored {player}! It was a privilege, truly." } },
+            { "friendly", { "Goodbye, {player}! Come back if you need anything looked up." } },
+            { "stoic", { "Farewell." } } } },
+        { "thanks",
+          { "thank you", "thanks", "much obliged" },
+          { "thank you", "thanks feylan", "much obliged" },
+          { { "deferential", { "You are far too kind, my lord. It is my duty and my honor." } },
+            { "friendly", { "Any time! It's nice to be useful." } },
+            { "stoic", { "It is my duty." } } } },
+    } },
+};
+
+// Lower case, runs of anything but letters, digits and apostrophes become one
+// space, padded with a space on each side so patterns can match whole words
+inline std::string normalize_for_intents(const std::string& text) {
+    std::string out = " ";
+    for (unsigned char c : text) {
+        if (std::isalnum(c) || c == '\'') out.push_back((char)std::tolower(c));
+        else if (out.back() != ' ') out.push_back(' ');
+    }
+    if (out.back() != ' ') out.push_back(' ');
+    return out;
+}
+
+// Aho-Corasick automaton over normalized text; patterns are stored padded
+// (" open the gate ") so every hit is on word boundaries
+class KeywordAutomaton {
+private:
+    struct Node {
+        std::vector<std::pair<char, int>> next;
+        int fail = 0;
+        std::vector<int> out;       // Labels of patterns ending here (after fail merging)
+    };
+    std::vector<Node> nodes{ Node{} };
+
+    int child(int n, char c) const {
+        for (const auto& [ch, to] : nodes[n].next) {
+            if (ch == c) return to;
+        }
+        return -1;
+    }
+
+public:
+    void add(const std::string& pattern, int label) {
+        std::string padded = normalize_for_intents(pattern);
+        int n = 0;
+        for (char c : padded) {
+            int to = child(n, c);
+            if (to < 0) {
+                to = (int)nodes.size();
+                nodes[n].next.emplace_back(c, to);
+                nodes.emplace_back();
+            }
+            n = to;
+        }
+        nodes[n].out.push_back(label);
+    }
+
+    // Call once after the last add()
+    void build() {
+        std::deque<int> bfs;
+        for (const auto& [c, to] : nodes[0].next) bfs.push_back(to);
+        while (!bfs.empty()) {
+            int n = bfs.front();
+            bfs.pop_front();
+            for (const auto& [c, to] : nodes[n].next) {
+                int f = nodes[n].fail;
+                while (f && child(f, c) < 0) f = nodes[f].fail;
+                int g = child(f, c);
+                nodes[to].fail = (g >= 0 && g != to) ? g : 0;
+                const auto& inherited = nodes[nodes[to].fail].out;
+                nodes[to].out.insert(nodes[to].out.end(), inherited.begin(), inherited.end());
+                bfs.push_back(to);
+            }
+        }
+    }
+
+    // Calls hit(label) for every pattern occurrence in already-normalized text
+    template <typename F>
+    void scan(const std::string& normalized, F&& hit) const {
+        int n = 0;
+        for (char c : normalized) {
+            while (n && child(n, c) < 0) n = nodes[n].fail;
+            int to = child(n, c);
+            n = (to >= 0) ? to : 0;
+            for (int label : nodes[n].out) hit(label);
+        }
+    }
+};
+
+inline std::vector<std::string> words_for_intents(const std::string& normalized) {
+    std::vector<std::string> words;
+    for (size_t start = 1; start < normalized.size();) {
+        size_t end = normalized.find(' ', start);
+        if (end == std::string::npos || end == start) break;
+        words.push_back(normalized.substr(start, end - start));
+        start = end + 1;
+    }
+    return words;
+}
+
+// Function words carry no intent; coverage ignores them
+inline bool is_intent_stopword(const std::string& w) {
+    static const std::set<std::string> stop = {
+        "a", "an", "the", "is", "are", "to", "of", "in", "for", "at", "on", "and", "or",
+        "do", "i", "you", "me", "my", "your", "it", "this", "that", "be", "can", "please",
+    };
+    return stop.count(w) > 0;
+}
+
+// Feature-hashed bag of words plus character trigrams, unit length
+using IntentEmbedding = std::array<float, INTENT_EMBED_DIM>;
+
+inline IntentEmbedding embed_for_intents(const std::string& normalized) {
+    IntentEmbedding v{};
+    auto add = [&](const char* p, size_t n, float w) {
+        uint32_t h = 2166136261u;   // FNV-1a; the top bit picks the sign
+        for (size_t i = 0; i < n; ++i) h = (h ^ (uint8_t)p[i]) * 16777619u;
+        v[h % INTENT_EMBED_DIM] += (h >> 31) ? w : -w;
+    };
+    for (const std::string& w : words_for_intents(normalized)) add(w.data(), w.size(), 1.0f);
+    for (size_t i = 0; i + 3 <= normalized.size(); ++i) add(normalized.data() + i, 3, INTENT_TRIGRAM_WEIGHT);
+
+    float norm = 0.0f;
+    for (float x : v) norm += x * x;
+    if (norm > 0.0f) {
+        norm = 1.0f / std::sqrt(norm);
+        for (float& x : v) x *= norm;
+    }
+    return v;
+}
+
+struct IntentMatch {
+    const AuthoredIntent* intent = nullptr;
+    double confidence = 0.0;    // Best intent's similarity plus keyword boost
+    double runner_up = 0.0;     // Same score for the next best intent
+    double coverage = 0.0;      // Share of the line's content words found in the best intent's examples and keywords
+    int content_words = 0;
+};
+
+// Classifies player lines against each NPC's authored intents: cosine
+// similarity to the nearest authored example, plus INTENT_KEYWORD_BOOST when
+// the line contains one of the intent's keywords. A routine opener in front
+// of a real question ("hello, have you seen my friend?") scores well on
+// similarity but leaves words unexplained, so coverage gates it too. On a
+// short line a single unknown word ("where is the poisoned well") is most
+// of its meaning, so short lines must be explained completely.
+// Built once; read-only after.
+class ScriptedResponder {
+private:
+    struct NpcIndex {
+        const std::vector<AuthoredIntent>* intents = nullptr;
+        KeywordAutomaton keywords;
+        std::vector<std::pair<int, IntentEmbedding>> examples;  // (intent, embedding)
+        std::vector<std::set<std::string>> vocab;               // Per intent: words of its examples and keywords
+    };
+    std::vector<NpcIndex> by_npc;   // Indexed like NPCS
+
+public:
+    ScriptedResponder() {
+        by_npc.resize(NPCS.size());
+        for (size_t n = 0; n < NPCS.size(); ++n) {
+            auto it = NPC_INTENTS.find(NPCS[n].name);
+            if (it == NPC_INTENTS.end()) continue;
+            NpcIndex& idx = by_npc[n];
+            idx.intents = &it->second;
+            idx.vocab.resize(it->second.size());
+            for (int i = 0; i < (int)it->second.size(); ++i) {
+                for (const std::string& k : it->second[i].keywords) {
+                    idx.keywords.add(k, i);
+                    for (std::string& w : words_for_intents(normalize_for_intents(k))) idx.vocab[i].insert(std::move(w));
+                }
+                for (const std::string& e : it->second[i].examples) {
+                    std::string text = normalize_for_intents(e);
+                    idx.examples.emplace_back(i, embed_for_intents(text));
+                    for (std::string& w : words_for_intents(text)) idx.vocab[i].insert(std::move(w));
+                }
+            }
+            idx.keywords.build();
+        }
+    }
+
+    IntentMatch classify(int npc_idx, const std::string& utterance) const {
+        IntentMatch m;
+        if (npc_idx < 0 || npc_idx >= (int)by_npc.size() || !by_npc[npc_idx].intents) return m;
+        const NpcIndex& idx = by_npc[npc_idx];
+        const std::vector<AuthoredIntent>& intents = *idx.intents;
+
+        std::string text = normalize_for_intents(utterance);
+        std::vector<double> score(intents.size(), 0.0);
+        std::vector<bool> keyword(intents.size(), false);
+        idx.keywords.scan(text, [&](int label) { keyword[label] = true; });
+
+        IntentEmbedding q = embed_for_intents(text);
+        for (const auto& [intent, e] : idx.examples) {
+            double dot = 0.0;
+            for (int d = 0; d < INTENT_EMBED_DIM; ++d) dot += q[d] * e[d];
+            score[intent] = std::max(score[intent], dot);
+        }
+        for (size_t i = 0; i < intents.size(); ++i) {
+            if (keyword[i]) score[i] = std::min(1.0, score[i] + INTENT_KEYWORD_BOOST);
+            if (!m.intent || score[i] > m.confidence) {
+                if (m.intent) m.runner_up = m.confidence;
+                m.intent = &intents[i];
+                m.confidence = score[i];
+            } else {
+                m.runner_up = std::max(m.runner_up, score[i]);
+            }
+        }
+
+        const std::set<std::string>& known = idx.vocab[m.intent - intents.data()];
+        int covered = 0;
+        for (const std::string& w : words_for_intents(text)) {
+            if (is_intent_stopword(w)) continue;
+            m.content_words++;
+            covered += known.count(w) > 0;
+        }
+        m.coverage = m.content_words ? (double)covered / m.content_words : 0.0;
+        return m;
+    }
+
+    // True when the match is confident and clear enough to answer without the LLM
+    static bool accept(const IntentMatch& m, double threshold) {
+        return m.intent && m.confidence >= threshold && m.confidence - m.runner_up >= INTENT_MARGIN &&
+               m.coverage >= (m.content_words < INTENT_SHORT_LINE ? 1.0 : INTENT_MIN_COVERAGE);
+    }
+
+    // A template for the NPC's current mood with the placeholders filled;
+    // empty when nothing is authored for that mood. `variant` picks among templates.
+    static std::string render(const IntentMatch& m, const std::string& mode, const NPCProfile& npc,
+                              const GameState& state, uint64_t variant) {
+        auto it = m.intent->replies.find(mode);
+        if (it == m.intent->replies.end() || it->second.empty()) return std::string();
+        std::string text = it->second[variant % it->second.size()];
+        const std::pair<const char*, const std::string*> fields[] = {
+            { "{player}", &state.player_name }, { "{class}", &state.player_class }, { "{npc}", &npc.name } };
+        for (const auto& [key, value] : fields) {
+            for (size_t pos = 0; (pos = text.find(key, pos)) != std::string::npos; pos += value->size()) {
+                text.replace(pos, std::strlen(key), *value);
+            }
+        }
+        return text;
+    }
+};
@@ -0,0 +1,279 @@
+// loadtest.h - Simulated concurrent players driving the dialogue engine in-process
+#pragma once
+
+#include "engine.h"
+#include "npc.h"
+#include <vector>
+#include <string>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <map>
+#include <cmath>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+struct LoadTestConfig {
+    int players = 16;
+    double duration_sec = 30.0;
+    double think_ms_mean = 2000.0;          // Exponential pause between a reply and the next line
+    double utterance_words_median = 8.0;    // Log-normal utterance length
+    double utterance_words_sigma = 0.6;
+    int npc_instances = 24;                 // NPCs in the world, each played by one of NPCS
+    double npc_zipf_s = 1.1;                // Popularity skew across NPC instances
+    double event_share = 0.0;               // Lines that are the same scripted event line to NPC 0
+    double routine_share = 0.0;             // Lines that are small talk (greetings, prices, directions, thanks)
+    double read_cps = 0.0;                  // Players read replies at this many chars/s; 0 = unpaced
+    double diurnal_period_sec = 0.0;        // Load swings quiet -> peak -> quiet over this long; 0 = steady
+    int shards = 1;                         // Players are split round-robin over this many game shards
+    double hot_shard_rate = 1.0;            // Shard 0's players talk this many times as often (a crowded event)
+    uint32_t seed = 42;
+};
+
+// Every player is a thread: think, pick an NPC by Zipfian popularity, say a
+// line of random length, and time the streamed reply piece by piece.
+class LoadTest {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Sample {
+        double ttft_ms;
+        double total_ms;
+        int tokens;
+        StopReason stop;
+        bool coalesced;
+        double stall_ms;
+        std::vector<double> itl_ms;
+    };
+
+    LoadTestConfig cfg;
+    std::vector<double> npc_cdf;
+    std::mutex samples_mutex;
+    std::vector<Sample> samples;
+    int failures = 0;
+
+    static const std::vector<std::string>& word_bank() {
+        static const std::vector<std::string> w = {
+            "hello", "may", "I", "enter", "the", "castle", "what", "news", "from", "court",
+            "how", "much", "for", "a", "room", "and", "an", "ale", "where", "is", "road",
+            "to", "king", "I", "seek", "work", "have", "you", "seen", "my", "friend", "thank",
+            "you", "good", "evening", "tell", "me", "about", "dynasty", "records", "gate",
+            "open", "please", "who", "rules", "here", "any", "rumors", "lately", "guard",
+        };
+        return w;
+    }
+
+    static const std::vector<std::string>& routine_lines() {
+        static const std::vector<std::string> r = {
+            "Hello there!", "Good evening.", "Greetings.", "Hi!", "How much for a room?",
+            "Can I get an ale?", "Where is the road to the village?", "Which way to the court?",
+            "May I enter?", "Thank you.", "Thanks!", "Farewell.", "Goodbye.",
+            "Do you keep the court records?", "I need a bed for the night.",
+        };
+        return r;
+    }
+
+    static double percentile(std::vector<double>& v, double p) {
+        if (v.empty()) return 0.0;
+        std::sort(v.begin(), v.end());
+        size_t idx = (size_t)std::ceil(p / 100.0 * v.size());
+        return v[std::min(v.size() - 1, idx > 0 ? idx - 1 : 0)];
+    }
+
+    static void print_latency_row(std::ostream& out, const char* label, std::vector<double>& v) {
+        out << "  " << std::left << std::setw(16) << label << std::right << std::setprecision(1)
+            << std::setw(9) << percentile(v, 50) << std::setw(9) << percentile(v, 95)
+            << std::setw(9) << percentile(v, 99)
+            << std::setw(9) << (v.empty() ? 0.0 : v.back()) << "\n";
+    }
+
+    int pick_npc(std::mt19937& rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return (int)(std::lower_bound(npc_cdf.begin(), npc_cdf.end(), u) - npc_cdf.begin());
+    }
+
+    std::string make_utterance(std::mt19937& rng) const {
+        std::lognormal_distribution<double> length(std::log(cfg.utterance_words_median), cfg.utterance_words_sigma);
+        int n_words = std::clamp((int)std::lround(length(rng)), 1, 60);
+        std::uniform_int_distribution<size_t> word(0, word_bank().size() - 1);
+        std::string line;
+        for (int i = 0; i < n_words; ++i) {
+            if (i) line += ' ';
+            line += word_bank()[word(rng)];
+        }
+        return line + "?";
+    }
+
+    void player_loop(DialogueEngine& engine, int player, Clock::time_point deadline) {
+        static const char* classes[] = { "warrior", "mage", "rogue", "bard" };
+        static const char* relations[] = { "stranger", "friend", "foe" };
+        static const char* actions[] = { "greet", "ask for help", "threaten", "trade" };
+
+        std::mt19937 rng(cfg.seed + player * 7919);
+        GameState state;
+        state.player_name = "Player" + std::to_string(player);
+        state.player_class = classes[rng() % 4];
+        state.player_level = 1 + rng() % 30;
+        state.relationship = relations[rng() % 3];
+        state.recent_action = actions[rng() % 4];
+
+        const int shard = player % std::max(1, cfg.shards);
+        double think_mean = cfg.think_ms_mean / (shard == 0 ? std::max(cfg.hot_shard_rate, 1e-3) : 1.0);
+        std::exponential_distribution<double> think(1.0 / std::max(think_mean, 1.0));
+        const auto start = Clock::now();
+        while (true) {
+            // A day compressed into diurnal_period_sec: players think up to 6x longer at night
+            double think_ms = think(rng);
+            if (cfg.diurnal_period_sec > 0.0) {
+                double phase = std::chrono::duration<double>(Clock::now() - start).count() / cfg.diurnal_period_sec;
+                double load = 0.5 - 0.5 * std::cos(6.283185307179586 * phase);
+                think_ms /= 0.15 + 0.85 * load;
+            }
+            auto wake = Clock::now() + std::chrono::microseconds((int64_t)(think_ms * 1000.0));
+            if (wake >= deadline) break;
+            std::this_thread::sleep_until(wake);
+
+            // An event: everyone near the gate asks the guard the same thing
+            bool event = std::uniform_real_distribution<double>(0.0, 1.0)(rng) < cfg.event_share;
+            int npc_instance = event ? 0 : pick_npc(rng);
+            TurnRequest req;
+            req.npc_idx = npc_instance % (int)NPCS.size();
+            if (cfg.shards > 1) req.tenant = "shard" + std::to_string(shard);
+            req.session_id = (req.tenant.empty() ? "" : req.tenant + "/") + state.player_name + "@npc" + std::to_string(npc_instance);
+            req.state = state;
+            bool routine = !event && std::uniform_real_distribution<double>(0.0, 1.0)(rng) < cfg.routine_share;
+            if (event) req.utterance = "What is all that noise at the gate?";
+            else if (routine) req.utterance = routine_lines()[rng() % routine_lines().size()];
+            else req.utterance = make_utterance(rng);
+            req.display_cps = cfg.read_cps;
+
+            std::vector<Clock::time_point> piece_times;
+            req.on_piece = [&piece_times](const std::string&) { piece_times.push_back(Clock::now()); };
+
+            auto submitted = Clock::now();
+            TurnResult r = engine.submit(std::move(req)).get();
+            auto done = Clock::now();
+
+            std::lock_guard<std::mutex> lock(samples_mutex);
+            if (!r.error.empty() || piece_times.empty()) {
+                failures++;
+                continue;
+            }
+            Sample s;
+            s.ttft_ms = std::chrono::duration<double, std::milli>(piece_times[0] - submitted).count();
+            s.total_ms = std::chrono::duration<double, std::milli>(done - submitted).count();
+            s.tokens = r.n_tokens;
+            s.stop = r.stop;
+            s.coalesced = r.coalesced;
+            s.stall_ms = r.stall_ms;
+            for (size_t i = 1; i < piece_times.size(); ++i) {
+                s.itl_ms.push_back(std::chrono::duration<double, std::milli>(piece_times[i] - piece_times[i - 1]).count());
+            }
+            samples.push_back(std::move(s));
+        }
+    }
+
+public:
+    explicit LoadTest(LoadTestConfig config) : cfg(config) {
+        // Zipfian popularity: NPC k is chosen with weight 1 / (k+1)^s
+        double sum = 0.0;
+        for (int k = 0; k < std::max(1, cfg.npc_instances); ++k) {
+            sum += 1.0 / std::pow(k + 1.0, cfg.npc_zipf_s);
+            npc_cdf.push_back(sum);
+        }
+        for (double& c : npc_cdf) c /= sum;
+    }
+
+    void run(DialogueEngine& engine, const std::string& backend_name, std::ostream& out) {
+        auto start = Clock::now();
+        auto deadline = start + std::chrono::microseconds((int64_t)(cfg.duration_sec * 1e6));
+
+        std::vector<std::thread> players;
+        for (int p = 0; p < cfg.players; ++p) {
+            players.emplace_back([this, &engine, p, deadline] { player_loop(engine, p, deadline); });
+        }
+        for (auto& t : players) t.join();
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::vector<double> ttft, itl, total, stall, generated_ttft;
+        std::map<std::string, int> stops;
+        long long tokens = 0;
+        int coalesced = 0, stalled = 0, scripted = 0;
+        for (const Sample& s : samples) {
+            coalesced += s.coalesced;
+            scripted += s.stop == StopReason::SCRIPTED;
+            if (s.stop != StopReason::SCRIPTED) generated_ttft.push_back(s.ttft_ms);
+            stall.push_back(s.stall_ms);
+            stalled += s.stall_ms > 0.0;
+            ttft.push_back(s.ttft_ms);
+            total.push_back(s.total_ms);
+            itl.insert(itl.end(), s.itl_ms.begin(), s.itl_ms.end());
+            tokens += s.tokens;
+            stops[stop_reason_name(s.stop)]++;
+        }
+
+        out << std::fixed;
+        out << "\n=== Load test: " << cfg.players << " players, " << std::setprecision(1) << elapsed
+            << " s, backend " << backend_name << ", " << engine.total_slots() << " slot(s) ===\n";
+        out << "  turns: " << samples.size() << " ok, " << failures << " failed ("
+            << std::setprecision(2) << samples.size() / elapsed << " turns/s)\n";
+        out << "  tokens: " << tokens << " (" << std::setprecision(1) << tokens / elapsed << " tok/s, "
+            << (samples.empty() ? 0.0 : (double)tokens / samples.size()) << " per turn)\n";
+        out << "  coalesced: " << coalesced << " turn(s) answered by another player's generation\n";
+        if (scripted > 0) {
+            out << "  scripted: " << scripted << " turn(s) answered from authored intents (" << std::setprecision(1)
+                << 100.0 * scripted / samples.size() << "%), ~" << engine.stats().scripted_saved_ms / 1000.0
+                << " s of generation saved\n";
+        }
+        out << "  latency ms           p50      p95      p99      max\n";
+        print_latency_row(out, "TTFT", ttft);
+        if (scripted > 0) print_latency_row(out, "TTFT generated", generated_ttft);
+        print_latency_row(out, "inter-token", itl);
+        print_latency_row(out, "turn", total);
+        if (cfg.read_cps > 0.0) print_latency_row(out, "display stall", stall);
+
+        // Stutter: how far single gaps stray from the typical one
+        double itl_mean = 0.0, itl_var = 0.0;
+        for (double ms : itl) itl_mean += ms;
+        itl_mean /= std::max<size_t>(itl.size(), 1);
+        for (double ms : itl) itl_var += (ms - itl_mean) * (ms - itl_mean);
+        out << "  inter-token jitter: stddev " << std::setprecision(1) << std::sqrt(itl_var / std::max<size_t>(itl.size(), 1))
+            << " ms, p99-p50 " << percentile(itl, 99) - percentile(itl, 50) << " ms\n";
+        out << "  stop reasons:";
+        for (const auto& [name, count] : stops) {
+            out << " " << name << " " << std::setprecision(1) << 100.0 * count / std::max<size_t>(samples.size(), 1) << "%";
+        }
+        out << "\n";
+        if (cfg.read_cps > 0.0) {
+            out << "  paced at " << std::setprecision(0) << cfg.read_cps << " chars/s: " << std::setprecision(1)
+                << 100.0 * stalled / std::max<size_t>(samples.size(), 1) << "% of turns stalled, "
+                << engine.stats().paced_skips << " slot-step(s) deferred\n";
+        }
+        if (cfg.shards > 1) {
+            out << "  shard      weight  kv quota     turns   tok/s   queue ms   TTFT p50   TTFT p95\n";
+            for (const TenantStats& t : engine.tenant_stats()) {
+                out << "  " << std::left << std::setw(10) << t.name << std::right << std::setprecision(1)
+                    << std::setw(7) << t.weight << std::setw(10) << t.max_in_flight << std::setw(10) << t.turns
+                    << std::setw(8) << t.tokens / elapsed << std::setw(11) << t.queue_ms
+                    << std::setw(11) << t.ttft_p50_ms << std::setw(11) << t.ttft_p95_ms << "\n";
+            }
+        }
+        EngineStats es = engine.stats();
+        if (es.handoffs > 0) {
+            out << "  prefill handoffs: " << es.handoffs << ", " << std::setprecision(1)
+                << es.handoff_bytes / 1048576.0 / es.handoffs << " MiB and "
+                << std::setprecision(2) << es.handoff_ms / es.handoffs << " ms each\n";
+        }
+
+        ShadowStats sh = engine.stats().shadow;
+        if (sh.steps > 0) {
+            out << "  shadow: " << sh.steps << " step(s) checked, token diffs " << sh.token_diffs
+                << ", top-" << SHADOW_TOPK << " diffs " << sh.topk_diffs << ", prob diffs " << sh.prob_diffs
+                << " (max " << std::setprecision(6) << sh.max_prob_diff << ")\n";
+            out << "          sampling path " << std::setprecision(1) << sh.path_us / sh.steps << " us/step vs reference "
+                << sh.reference_us / sh.steps << " us/step\n";
+        }
+    }
+};
@@ -0,0 +1,192 @@
+// memstats.h - Memory footprint accounting per component and per NPC session
+#pragma once
+
+#include "llama.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+struct MemoryComponent {
+    std::string name;
+    size_t bytes = 0;
+};
+
+// Everything one conversation owns on top of the shared model and context
+struct SessionMemory {
+    std::string label;
+    std::vector<MemoryComponent> components;
+
+    void add(const std::string& name, size_t bytes) { components.push_back({ name, bytes }); }
+
+    size_t total() const {
+        size_t sum = 0;
+        for (const auto& c : components) sum += c.bytes;
+        return sum;
+    }
+};
+
+template <typename T>
+size_t vector_bytes(const std::vector<T>& v) { return v.capacity() * sizeof(T); }
+
+// llama.cpp only reports its backend buffers (weights, KV cache, compute and
+// output) in the load log, so we listen to the log and pick up every
+// "<backend> <kind> buffer size = <n> MiB" line while forwarding it to stderr
+// exactly like the default logger does. Buffers logged while a context is
+// created under capture() are handed back by release() when it is freed.
+class MemoryAccountant {
+public:
+    using Allocation = std::map<std::string, double>;   // kind -> MiB
+
+private:
+    mutable std::mutex mutex;
+    Allocation backend_mib;     // Summed over live backends
+    const llama_model* model = nullptr;
+    static inline thread_local Allocation* capturing = nullptr;     // Set on the thread creating a context
+
+    static void log_hook(ggml_log_level level, const char* text, void* user_data) {
+        (void)level;
+        std::fputs(text, stderr);
+        static_cast<MemoryAccountant*>(user_data)->scan_log_line(text);
+    }
+
+    void scan_log_line(const char* text) {
+        const char* marker = std::strstr(text, " buffer size =");
+        if (!marker) return;
+
+        // The word right before the marker is the buffer kind
+        const char* kind_end = marker;
+        const char* kind_begin = kind_end;
+        while (kind_begin > text && kind_begin[-1] != ' ') --kind_begin;
+        std::string kind(kind_begin, kind_end);
+        if (kind.empty()) return;
+
+        double mib = std::atof(marker + std::strlen(" buffer size ="));
+        if (capturing) (*capturing)[kind] += mib;
+        std::lock_guard<std::mutex> lock(mutex);
+        backend_mib[kind] += mib;
+    }
+
+    static std::string component_label(const std::string& kind) {
+        if (kind == "model") return "model weights";
+        if (kind == "KV") return "KV cache";
+        if (kind == "compute") return "compute buffers";
+        if (kind == "output") return "output buffer";
+        return kind + " buffer";
+    }
+
+public:
+    // Call before llama_model_load_from_file() so the model buffers are seen
+    void install_log_hook() { llama_log_set(&MemoryAccountant::log_hook, this); }
+
+    void set_model(const llama_model* m) { model = m; }
+
+    // Runs `create` and returns what it allocated along with its result
+    template <typename Fn>
+    auto capture(Fn&& create, Allocation& allocated) {
+        Allocation* outer = capturing;
+        capturing = &allocated;
+        auto result = create();
+        capturing = outer;
+        return result;
+    }
+
+    // Subtracts buffers freed with their context
+    void release(const Allocation& freed) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& [kind, mib] : freed) backend_mib[kind] = std::max(0.0, backend_mib[kind] - mib);
+    }
+
+    // Resident set size of the whole process, 0 where unavailable
+    static size_t resident_bytes() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 6, "VmRSS:") == 0) {
+                return (size_t)std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+            }
+        }
+        return 0;
+    }
+
+    // Shared components: weights, KV cache, compute and output buffers
+    std::vector<MemoryComponent> process_components() const {
+        std::vector<MemoryComponent> out;
+        bool have_weights = false;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& [kind, mib] : backend_mib) {
+            out.push_back({ component_label(kind), (size_t)(mib * 1024.0 * 1024.0) });
+            if (kind == "model") have_weights = true;
+        }
+        if (!have_weights && model) {
+            out.insert(out.begin(), { "model weights", (size_t)llama_model_size(model) });
+        }
+        return out;
+    }
+
+    size_t backend_bytes(const std::string& kind) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = backend_mib.find(kind);
+        return (it != backend_mib.end()) ? (size_t)(it->second * 1024.0 * 1024.0) : 0;
+    }
+
+    static std::string format_bytes(size_t bytes) {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1);
+        if (bytes >= (size_t(1) << 30)) oss << bytes / double(1 << 30) << " GiB";
+        else if (bytes >= (size_t(1) << 20)) oss << bytes / double(1 << 20) << " MiB";
+        else oss << bytes / 1024.0 << " KiB";
+        return oss.str();
+    }
+
+    // One-line summary for the per-turn stats output
+    std::string summary_line(const std::vector<SessionMemory>& sessions) const {
+        size_t session_total = 0;
+        for (const auto& s : sessions) session_total += s.total();
+        return "[Mem RSS " + format_bytes(resident_bytes()) +
+               " | KV " + format_bytes(backend_bytes("KV")) +
+               " | compute " + format_bytes(backend_bytes("compute")) +
+               " | " + std::to_string(sessions.size()) + " session(s) " + format_bytes(session_total) + "]\n";
+    }
+
+    // Full breakdown: shared components, every session, and what RSS leaves over
+    std::string report(const std::vector<SessionMemory>& sessions) const {
+        std::ostringstream oss;
+        size_t accounted = 0;
+
+        oss << "\n=== Memory footprint ===\n";
+        for (const auto& c : process_components()) {
+            oss << "  " << std::left << std::setw(26) << c.name << std::right
+                << std::setw(12) << format_bytes(c.bytes) << "\n";
+            accounted += c.bytes;
+        }
+
+        for (const auto& s : sessions) {
+            oss << "  session " << s.label << ": " << format_bytes(s.total()) << "\n";
+            for (const auto& c : s.components) {
+                oss << "    " << std::left << std::setw(24) << c.name << std::right
+                    << std::setw(12) << format_bytes(c.bytes) << "\n";
+            }
+            accounted += s.total();
+        }
+
+        size_t rss = resident_bytes();
+        if (rss > 0) {
+            oss << "  " << std::left << std::setw(26) << "process RSS" << std::right
+                << std::setw(12) << format_bytes(rss) << "\n";
+            if (rss > accounted) {
+                oss << "  " << std::left << std::setw(26) << "unaccounted (runtime, libs)" << std::right
+                    << std::setw(12) << format_bytes(rss - accounted) << "\n";
+            }
+        }
+        return oss.str();
+    }
+};
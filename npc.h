@@ -0,0 +1,141 @@
+// npc.h - NPC profiles, personality modes, prompt construction
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <cctype>
+
+// ---- Personality Modes ----
+struct PersonalityMode {
+    std::string mode_name;
+    std::string prompt_modifier;
+    int min_tokens;
+    int max_tokens;
+};
+
+inline const std::vector<PersonalityMode> ALL_PERSONALITY_MODES = {
+    { "friendly",   "You respond with warmth, politeness, and helpfulness. Speak in complete sentences.", 15, 150 },
+    { "rude",       "You respond curtly, with irritation, sarcasm, or disrespect. Keep responses brief but complete.", 8, 80 },
+    { "suspicious", "You respond with mistrust, guarded language, and evasiveness. Answer hesitantly.", 12, 120 },
+    { "deferential","You are very respectful and submissive to the speaker. Use honorifics and speak humbly.", 20, 200 },
+    { "stoic",      "You speak briefly with little emotion, but still provide complete thoughts.", 10, 60 }
+};
+
+inline const PersonalityMode* get_mode_by_name(const std::string& name) {
+    for (const auto& m : ALL_PERSONALITY_MODES)
+        if (m.mode_name == name) return &m;
+    return &ALL_PERSONALITY_MODES[0];
+}
+
+// ---- NPC Profiles ----
+struct NPCProfile {
+    std::string name;
+    std::string base_prompt;
+    std::vector<std::string> allowed_modes;
+    std::string background_info;
+};
+
+inline const std::vector<NPCProfile> NPCS = {
+    {   // 0
+        "Krackle",
+        "You are Krackle, the deadly front door guard to the Ramsel Dynasty. You are blunt, experienced, and have no time for nonsense. You've seen many adventurers come and go.",
+        {"friendly", "rude", "suspicious"},
+        "A veteran guard who has protected the dynasty for decades. Wears battle-scarred armor and carries an ancient sword."
+    },
+    {   // 1
+        "Mira",
+        "You are Mira, a world-weary but kind tavernkeeper who welcomes all sorts but is slow to trust. You've heard countless stories from travelers.",
+        {"friendly", "suspicious", "stoic"},
+        "Runs 'The Weary Traveler' tavern. Has graying hair and knowing eyes that have seen much of the world through her patrons."
+    },
+    {   // 2
+        "Feylan",
+        "You are Feylan, an anxious young court scribe. You are always deferential to those in authority and eager to help with your knowledge of court matters and records.",
+        {"deferential", "friendly", "stoic"},
+        "A young scholar with ink-stained fingers and nervous habits. Knows the history and procedures of the royal court intimately."
+    }
+};
+
+struct GameState {
+    std::string player_name;
+    std::string player_class;
+    std::string relationship;      // "stranger", "friend", "foe"
+    int player_level;
+    std::string recent_action;     // e.g. "threaten", "ask for help"
+};
+
+inline std::string to_lower(const std::string& s) {
+    std::string out = s;
+    std::transform(out.begin(), out.end(), out.begin(),
+        [](unsigned char c){ return std::tolower(c); });
+    return out;
+}
+
+// --- Smart Mode Selection ---
+inline std::string pick_mode_for_npc(const NPCProfile& npc, const GameState& state, const std::string& user_input) {
+    // THREAT OVERRIDE: If player threatens, always go "rude" if allowed
+    std::string input_lc = to_lower(user_input + " " + state.recent_action);
+    if ((input_lc.find("threaten") != std::string::npos ||
+         input_lc.find("kill") != std::string::npos ||
+         input_lc.find("harm") != std::string::npos ||
+         input_lc.find("attack") != std::string::npos) &&
+         std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "rude") != npc.allowed_modes.end())
+    {
+        return "rude";
+    }
+
+    // RELATIONSHIP (friend/foe/stranger)
+    if (state.relationship == "friend") {
+        if (std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "friendly") != npc.allowed_modes.end())
+            return "friendly";
+    } else if (state.relationship == "foe") {
+        if (std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "rude") != npc.allowed_modes.end())
+            return "rude";
+        if (std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "suspicious") != npc.allowed_modes.end())
+            return "suspicious";
+    } else if (state.relationship == "stranger") {
+        if (std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "suspicious") != npc.allowed_modes.end())
+            return "suspicious";
+    }
+
+    if (input_lc.find("thank") != std::string::npos && 
+        std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "friendly") != npc.allowed_modes.end())
+        return "friendly";
+
+    if ((input_lc.find("king") != std::string::npos || input_lc.find("queen") != std::string::npos || 
+         input_lc.find("majesty") != std::string::npos || input_lc.find("lord") != std::string::npos) &&
+        std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "deferential") != npc.allowed_modes.end())
+        return "deferential";
+
+    return npc.allowed_modes[0];
+}
+
+// --- IMPROVED Prompt Construction ---
+inline std::string inject_prompt_context(const NPCProfile& npc, const PersonalityMode& mode,
+                                  const GameState& state, const std::string& user_input) {
+    std::ostringstream oss;
+    
+    // Use a more conversational format instead of strict ### headers
+    oss << "You are " << npc.name << ". " << npc.base_prompt << "\n\n";
+    oss << "Background: " << npc.background_info << "\n\n";
+    oss << "Current situation: ";
+    oss << "You are speaking with " << state.player_name;
+    oss << " (a level " << state.player_level << " " << state.player_class << ") ";
+    oss << "who is a " << state.relationship << " to you.\n\n";
+    
+    oss << "Your current mood/behavior: " << mode.prompt_modifier << "\n\n";
+    
+    oss << "Important rules:\n";
+    oss << "- Respond as " << npc.name << " would, staying in character\n";
+    oss << "- Give thoughtful, complete responses (not just one word)\n";
+    oss << "- Do not speak for the other person or continue their dialogue\n";
+    oss << "- Respond naturally as if in a real conversation\n\n";
+    
+    oss << state.player_name << " says: \"" << user_input << "\"\n\n";
+    oss << npc.name << " responds: \"";
+    
+    return oss.str();
+}
+
\ No newline at end of file
@@ -0,0 +1,198 @@
+// profiler.h - Per-op decode profiler driven by the ggml graph eval callback
+#pragma once
+
+#include "llama.h"
+#include "ggml.h"
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+
+// Times every graph node llama_decode() evaluates and buckets it by op type
+// (matmul per weight quant type, attention, norm, rope, ...), separately for
+// prompt prefill and single-token decode. Enabling it forces the scheduler to
+// synchronize after every node, so absolute numbers run slower than an
+// unprofiled build - use the percentages to compare ops, not the raw ms.
+class DecodeProfiler {
+public:
+    enum Phase { PHASE_PREFILL = 0, PHASE_DECODE = 1, PHASE_COUNT = 2 };
+
+private:
+    struct OpStats {
+        double total_us = 0.0;
+        uint64_t calls = 0;
+    };
+
+    struct PhaseStats {
+        std::map<std::string, OpStats> ops;
+        double wall_us = 0.0;   // Time spent inside llama_decode()
+        uint64_t tokens = 0;    // Tokens submitted in this phase
+        uint64_t evals = 0;     // Number of llama_decode() calls
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    bool enabled = false;
+    Phase current_phase = PHASE_DECODE;
+    Clock::time_point eval_start;
+    Clock::time_point node_start;
+    bool node_pending = false;
+
+    PhaseStats turn[PHASE_COUNT];     // Reset at the start of every turn
+    PhaseStats session[PHASE_COUNT];  // Accumulated until exit
+
+public:
+    // Hook the profiler into the context params before llama_init_from_model()
+    void attach(llama_context_params& ctx_params) {
+        ctx_params.cb_eval = &DecodeProfiler::eval_callback;
+        ctx_params.cb_eval_user_data = this;
+        enabled = true;
+    }
+
+    bool is_enabled() const { return enabled; }
+
+    // Bracket every llama_decode() call with begin()/end()
+    void begin(Phase phase, int n_tokens) {
+        if (!enabled) return;
+        current_phase = phase;
+        turn[phase].tokens += n_tokens;
+        turn[phase].evals++;
+        node_pending = false;
+        eval_start = Clock::now();
+    }
+
+    void end() {
+        if (!enabled) return;
+        turn[current_phase].wall_us += elapsed_us(eval_start);
+    }
+
+    // Fold the current turn into the session totals and start a new one
+    void reset_turn() {
+        for (int p = 0; p < PHASE_COUNT; ++p) {
+            merge(session[p], turn[p]);
+            turn[p] = PhaseStats{};
+        }
+    }
+
+    std::string turn_report() const { return format_report("turn", turn); }
+
+    std::string session_report() const {
+        PhaseStats total[PHASE_COUNT];
+        for (int p = 0; p < PHASE_COUNT; ++p) {
+            total[p] = session[p];
+            merge(total[p], turn[p]);
+        }
+        return format_report("session", total);
+    }
+
+private:
+    static double elapsed_us(Clock::time_point since) {
+        return std::chrono::duration<double, std::micro>(Clock::now() - since).count();
+    }
+
+    static void merge(PhaseStats& into, const PhaseStats& from) {
+        for (const auto& [name, op] : from.ops) {
+            into.ops[name].total_us += op.total_us;
+            into.ops[name].calls += op.calls;
+        }
+        into.wall_us += from.wall_us;
+        into.tokens += from.tokens;
+        into.evals += from.evals;
+    }
+
+    // Layout-only ops cost nothing; leaving them unobserved lets the scheduler
+    // batch them with the next real node instead of syncing on each one.
+    static bool is_noop(const ggml_tensor* t) {
+        switch (t->op) {
+            case GGML_OP_NONE:
+            case GGML_OP_VIEW:
+            case GGML_OP_RESHAPE:
+            case GGML_OP_PERMUTE:
+            case GGML_OP_TRANSPOSE:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    static bool is_attention_tensor(const ggml_tensor* t) {
+        // llama.cpp names the attention products "kq-<layer>", "kqv-<layer>", ...
+        const char* name = ggml_get_name(t);
+        return std::strncmp(name, "kq", 2) == 0 || std::strncmp(name, "fattn", 5) == 0;
+    }
+
+    static std::string classify(const ggml_tensor* t) {
+        switch (t->op) {
+            case GGML_OP_MUL_MAT:
+                if (is_attention_tensor(t)) return "attention";
+                return std::string("matmul ") + ggml_type_name(t->src[0]->type);
+            case GGML_OP_SOFT_MAX:
+            case GGML_OP_FLASH_ATTN_EXT:
+                return "attention";
+            case GGML_OP_NORM:
+            case GGML_OP_RMS_NORM:
+                return "norm";
+            case GGML_OP_ROPE:
+                return "rope";
+            default:
+                return ggml_op_desc(t);
+        }
+    }
+
+    // With a callback installed the scheduler asks about each node before
+    // computing it, then calls back with ask=false once the observed node is
+    // done. Everything between the first ask and the answer belongs to that node.
+    static bool eval_callback(ggml_tensor* t, bool ask, void* user_data) {
+        auto* self = static_cast<DecodeProfiler*>(user_data);
+        if (ask) {
+            if (!self->node_pending) {
+                self->node_start = Clock::now();
+                self->node_pending = true;
+            }
+            return !is_noop(t);
+        }
+
+        OpStats& op = self->turn[self->current_phase].ops[classify(t)];
+        op.total_us += elapsed_us(self->node_start);
+        op.calls++;
+        self->node_pending = false;
+        return true;
+    }
+
+    static std::string format_report(const char* label, const PhaseStats (&stats)[PHASE_COUNT]) {
+        static const char* phase_names[PHASE_COUNT] = { "prefill", "decode" };
+        std::ostringstream oss;
+        oss << std::fixed;
+
+        for (int p = 0; p < PHASE_COUNT; ++p) {
+            const PhaseStats& ps = stats[p];
+            if (ps.evals == 0) continue;
+
+            double op_total_us = 0.0;
+            std::vector<std::pair<std::string, OpStats>> rows(ps.ops.begin(), ps.ops.end());
+            for (const auto& row : rows) op_total_us += row.second.total_us;
+            std::sort(rows.begin(), rows.end(),
+                      [](const auto& a, const auto& b) { return a.second.total_us > b.second.total_us; });
+
+            double tokens = std::max<uint64_t>(ps.tokens, 1);
+            oss << "[Profile " << label << " " << phase_names[p] << ": "
+                << ps.tokens << " tok, " << ps.evals << " evals, "
+                << std::setprecision(1) << ps.wall_us / 1000.0 << " ms wall, "
+                << std::setprecision(2) << ps.wall_us / 1000.0 / tokens << " ms/tok]\n";
+
+            for (const auto& [name, op] : rows) {
+                double share = op_total_us > 0.0 ? 100.0 * op.total_us / op_total_us : 0.0;
+                oss << "  " << std::left << std::setw(18) << name << std::right
+                    << std::setprecision(1) << std::setw(10) << op.total_us / 1000.0 << " ms "
+                    << std::setw(6) << share << "% "
+                    << std::setprecision(3) << std::setw(9) << op.total_us / 1000.0 / tokens << " ms/tok "
+                    << std::setw(8) << op.calls << " nodes\n";
+            }
+        }
+        return oss.str();
+    }
+};
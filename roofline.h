@@ -0,0 +1,317 @@
+// roofline.h - Memory-bandwidth roofline benchmark for decode efficiency
+#pragma once
+
+#include "llama.h"
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+#define ROOFLINE_BUFFER_MB 512      // Per-node working set, well past any LLC
+#define ROOFLINE_REPEATS 5          // Best-of-N for each bandwidth kernel
+#define ROOFLINE_PROMPT_TOKENS 64   // Prefill per sequence before timing decode
+#define ROOFLINE_DECODE_STEPS 32    // Timed decode steps per batch size
+#define ROOFLINE_MAX_BATCH 8        // Largest parallel-sequence batch to sweep
+
+// Single-sequence decode streams every weight once per token, so the best it
+// can do is (memory bandwidth) / (bytes read per token). This measures the
+// host bandwidth per NUMA node, derives that ceiling from the model size and
+// reports how close llama_decode() gets to it as batch size grows.
+namespace roofline {
+
+struct NumaNode {
+    int id = 0;
+    std::vector<int> cpus;
+};
+
+struct Bandwidth {
+    double read_gbs = 0.0;   // Streaming sum over one buffer (decode-like)
+    double triad_gbs = 0.0;  // a = b + s*c, counts 2 reads + 1 write
+};
+
+// "0-3,8-11" -> {0,1,2,3,8,9,10,11}
+inline std::vector<int> parse_cpulist(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty()) continue;
+        size_t dash = range.find('-');
+        int lo = std::stoi(range.substr(0, dash));
+        int hi = (dash == std::string::npos) ? lo : std::stoi(range.substr(dash + 1));
+        for (int c = lo; c <= hi; ++c) cpus.push_back(c);
+    }
+    return cpus;
+}
+
+inline std::vector<NumaNode> detect_numa_nodes() {
+    std::vector<NumaNode> nodes;
+#ifdef __linux__
+    if (DIR* dir = opendir("/sys/devices/system/node")) {
+        while (dirent* ent = readdir(dir)) {
+            if (std::strncmp(ent->d_name, "node", 4) != 0) continue;
+            if (!std::isdigit((unsigned char)ent->d_name[4])) continue;
+            std::ifstream in(std::string("/sys/devices/system/node/") + ent->d_name + "/cpulist");
+            std::string list;
+            if (!std::getline(in, list)) continue;
+            NumaNode node;
+            node.id = std::atoi(ent->d_name + 4);
+            node.cpus = parse_cpulist(list);
+            if (!node.cpus.empty()) nodes.push_back(node);
+        }
+        closedir(dir);
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+#endif
+    if (nodes.empty()) {
+        // No NUMA information: treat the whole machine as one unpinned node
+        NumaNode node;
+        unsigned int n = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int c = 0; c < n; ++c) node.cpus.push_back(-1);
+        nodes.push_back(node);
+    }
+    return nodes;
+}
+
+inline void pin_current_thread(int cpu) {
+#ifdef __linux__
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+// Runs the read and triad kernels with one pinned thread per CPU in `cpus`.
+// Each thread first-touches its own slice so pages land on the local node.
+inline Bandwidth measure_bandwidth(const std::vector<int>& cpus, size_t bytes) {
+    const size_t n_threads = cpus.size();
+    const size_t per_thread = std::max<size_t>(bytes / sizeof(double) / 3 / n_threads, 1024);
+
+    std::vector<std::vector<double>*> a(n_threads), b(n_threads), c(n_threads);
+    std::vector<double> read_sec(ROOFLINE_REPEATS, 0.0), triad_sec(ROOFLINE_REPEATS, 0.0);
+    std::atomic<int> ready{0};
+    std::atomic<int> phase{-1};
+    std::atomic<int> done{0};
+    std::atomic<uint64_t> sink{0};
+
+    auto worker = [&](size_t t) {
+        pin_current_thread(cpus[t]);
+        a[t] = new std::vector<double>(per_thread, 1.0);
+        b[t] = new std::vector<double>(per_thread, 2.0);
+        c[t] = new std::vector<double>(per_thread, 0.5);
+        ready.fetch_add(1);
+
+        for (int run = 0; run < ROOFLINE_REPEATS * 2; ++run) {
+            while (phase.load(std::memory_order_acquire) < run) std::this_thread::yield();
+            if (run % 2 == 0) {
+                // Read kernel: four independent accumulators keep loads in flight
+                const double* p = b[t]->data();
+                double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+                for (size_t i = 0; i + 3 < per_thread; i += 4) {
+                    s0 += p[i]; s1 += p[i + 1]; s2 += p[i + 2]; s3 += p[i + 3];
+                }
+                sink.fetch_add((uint64_t)(s0 + s1 + s2 + s3), std::memory_order_relaxed);
+            } else {
+                double* pa = a[t]->data();
+                const double* pb = b[t]->data();
+                const double* pc = c[t]->data();
+                for (size_t i = 0; i < per_thread; ++i) pa[i] = pb[i] + 3.0 * pc[i];
+            }
+            done.fetch_add(1, std::memory_order_acq_rel);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < n_threads; ++t) threads.emplace_back(worker, t);
+    while (ready.load() < (int)n_threads) std::this_thread::yield();
+
+    for (int run = 0; run < ROOFLINE_REPEATS * 2; ++run) {
+        done.store(0);
+        auto start = std::chrono::steady_clock::now();
+        phase.store(run, std::memory_order_release);
+        while (done.load(std::memory_order_acquire) < (int)n_threads) std::this_thread::yield();
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        (run % 2 == 0 ? read_sec : triad_sec)[run / 2] = sec;
+    }
+    for (auto& th : threads) th.join();
+    for (size_t t = 0; t < n_threads; ++t) { delete a[t]; delete b[t]; delete c[t]; }
+
+    double slice_bytes = (double)per_thread * sizeof(double) * n_threads;
+    Bandwidth bw;
+    bw.read_gbs = slice_bytes / *std::min_element(read_sec.begin(), read_sec.end()) / 1e9;
+    bw.triad_gbs = 3.0 * slice_bytes / *std::min_element(triad_sec.begin(), triad_sec.end()) / 1e9;
+    return bw;
+}
+
+// Bytes of K+V read per token of context for one sequence (f16 cache)
+inline double kv_bytes_per_position(const llama_model* model) {
+    double n_embd_kv = (double)llama_model_n_embd(model) / llama_model_n_head(model) * llama_model_n_head_kv(model);
+    return 2.0 * llama_model_n_layer(model) * n_embd_kv * 2.0;
+}
+
+struct BatchResult {
+    int batch = 0;
+    double step_ms = 0.0;
+    double tokens_per_sec = 0.0;
+};
+
+// Times ROOFLINE_DECODE_STEPS decode steps with `batch` parallel sequences.
+// The same token is fed every step - we only care about the weight traffic.
+inline bool time_batched_decode(llama_context* ctx, const std::vector<llama_token>& prompt,
+                                int batch, BatchResult& result) {
+    const int n_prompt = (int)prompt.size();
+    llama_kv_cache_clear(ctx);
+
+    llama_batch b = llama_batch_init(std::max(n_prompt, batch), 0, 1);
+    for (int s = 0; s < batch; ++s) {
+        b.n_tokens = 0;
+        for (int i = 0; i < n_prompt; ++i) {
+            b.token[b.n_tokens] = prompt[i];
+            b.pos[b.n_tokens] = i;
+            b.n_seq_id[b.n_tokens] = 1;
+            b.seq_id[b.n_tokens][0] = s;
+            b.logits[b.n_tokens] = (i == n_prompt - 1);
+            b.n_tokens++;
+        }
+        if (llama_decode(ctx, b) != 0) {
+            llama_batch_free(b);
+            return false;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int step = 0; step < ROOFLINE_DECODE_STEPS; ++step) {
+        b.n_tokens = 0;
+        for (int s = 0; s < batch; ++s) {
+            b.token[b.n_tokens] = prompt.back();
+            b.pos[b.n_tokens] = n_prompt + step;
+            b.n_seq_id[b.n_tokens] = 1;
+            b.seq_id[b.n_tokens][0] = s;
+            b.logits[b.n_tokens] = true;
+            b.n_tokens++;
+        }
+        if (llama_decode(ctx, b) != 0) {
+            llama_batch_free(b);
+            return false;
+        }
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    llama_batch_free(b);
+
+    result.batch = batch;
+    result.step_ms = sec * 1000.0 / ROOFLINE_DECODE_STEPS;
+    result.tokens_per_sec = (double)batch * ROOFLINE_DECODE_STEPS / sec;
+    return true;
+}
+
+// Full report: bandwidth per node, theoretical decode ceiling, batch scaling
+inline int run_benchmark(llama_model* model, llama_context_params ctx_params, std::ostream& out) {
+    out << std::fixed;
+
+    // --- Host bandwidth ---
+    std::vector<NumaNode> nodes = detect_numa_nodes();
+    const size_t buffer_bytes = (size_t)ROOFLINE_BUFFER_MB << 20;
+    out << "\n=== Memory bandwidth (best of " << ROOFLINE_REPEATS << ", "
+        << ROOFLINE_BUFFER_MB << " MiB per node) ===\n";
+
+    std::vector<int> all_cpus;
+    for (const NumaNode& node : nodes) {
+        Bandwidth bw = measure_bandwidth(node.cpus, buffer_bytes);
+        out << "  node " << node.id << " (" << node.cpus.size() << " cpus): read "
+            << std::setprecision(1) << bw.read_gbs << " GB/s, triad " << bw.triad_gbs << " GB/s\n";
+        all_cpus.insert(all_cpus.end(), node.cpus.begin(), node.cpus.end());
+    }
+    Bandwidth host = (nodes.size() > 1) ? measure_bandwidth(all_cpus, buffer_bytes * nodes.size())
+                                        : measure_bandwidth(nodes[0].cpus, buffer_bytes);
+    if (nodes.size() > 1) {
+        out << "  all nodes: read " << std::setprecision(1) << host.read_gbs
+            << " GB/s, triad " << host.triad_gbs << " GB/s\n";
+    }
+
+    // --- Theoretical ceiling ---
+    char desc[256] = {0};
+    llama_model_desc(model, desc, sizeof(desc));
+    const double weight_bytes = (double)llama_model_size(model);
+    const double kv_per_pos = kv_bytes_per_position(model);
+    const int context_at_decode = ROOFLINE_PROMPT_TOKENS + ROOFLINE_DECODE_STEPS / 2;
+    const double bw_bytes = host.read_gbs * 1e9;
+
+    auto roof_tps = [&](int batch) {
+        // One pass over the weights serves every sequence in the batch
+        double bytes_per_step = weight_bytes + batch * kv_per_pos * context_at_decode;
+        return batch * bw_bytes / bytes_per_step;
+    };
+
+    out << "\n=== Decode roofline ===\n";
+    out << "  model: " << desc << ", " << std::setprecision(2) << weight_bytes / (1 << 30) << " GiB weights, "
+        << std::setprecision(1) << kv_per_pos / 1024.0 << " KiB KV per position\n";
+    out << "  theoretical max single-sequence decode: " << roof_tps(1) << " tok/s\n";
+
+    // --- Measured batch scaling ---
+    ctx_params.n_seq_max = ROOFLINE_MAX_BATCH;
+    ctx_params.n_ctx = ROOFLINE_MAX_BATCH * (ROOFLINE_PROMPT_TOKENS + ROOFLINE_DECODE_STEPS + 8);
+    ctx_params.n_batch = std::max<uint32_t>(ctx_params.n_batch, ROOFLINE_PROMPT_TOKENS);
+    llama_context* ctx = llama_init_from_model(model, ctx_params);
+    if (!ctx) {
+        std::cerr << "Failed to initialize benchmark context" << std::endl;
+        return 1;
+    }
+
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    std::string filler = "The guard looks you over and says that the gate is closed for the night.";
+    std::vector<llama_token> prompt(ROOFLINE_PROMPT_TOKENS);
+    int32_t n = llama_tokenize(vocab, filler.c_str(), filler.size(), prompt.data(), prompt.size(), true, false);
+    if (n <= 0) {
+        std::cerr << "Tokenization failed" << std::endl;
+        llama_free(ctx);
+        return 1;
+    }
+    for (int i = n; i < ROOFLINE_PROMPT_TOKENS; ++i) prompt[i] = prompt[1 + (i - n) % std::max(n - 1, 1)];
+
+    out << "\n  batch   tok/s   step ms   roof tok/s   efficiency\n";
+    double single_eff = 0.0;
+    for (int batch = 1; batch <= ROOFLINE_MAX_BATCH; batch *= 2) {
+        BatchResult r;
+        if (!time_batched_decode(ctx, prompt, batch, r)) {
+            std::cerr << "Decode failed at batch " << batch << std::endl;
+            break;
+        }
+        double eff = 100.0 * r.tokens_per_sec / roof_tps(batch);
+        if (batch == 1) single_eff = eff;
+        out << "  " << std::setw(5) << batch
+            << std::setprecision(1) << std::setw(8) << r.tokens_per_sec
+            << std::setprecision(2) << std::setw(10) << r.step_ms
+            << std::setprecision(1) << std::setw(13) << roof_tps(batch)
+            << std::setw(12) << eff << "%\n";
+    }
+
+    out << "\n  single-sequence decode efficiency: " << std::setprecision(1) << single_eff << "% of bandwidth roof\n";
+    if (single_eff >= 80.0) {
+        out << "  -> at the roof: more threads won't help, batch sequences for throughput\n";
+    } else {
+        out << "  -> below the roof: thread count / placement still has headroom\n";
+    }
+
+    llama_free(ctx);
+    return 0;
+}
+
+} // namespace roofline
@@ -0,0 +1,151 @@
+// sampling.h - Sampling constants and their runtime-configurable, per NPC/mode overrides
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+
+// --- IMPROVED Sampling Constants ---
+#define DEFAULT_MAX_OUTPUT_TOKENS 300
+#define DEFAULT_MAX_TOKENS 4096
+#define DEFAULT_N_CTX 1024  // Keep context realistic
+#define TOP_CAND 120        // number of logits to keep per step
+#define TOP_K 40            // Reduced for better quality
+#define TOP_P 0.95f         // Increased for more variety
+#define TEMP 0.8f           // Reduced temperature for better coherence
+#define ALPHA 0.1f          // Reduced alpha
+#define BASELINE 3.0f       // Adjusted baseline
+#define MIN_SCALING 0.7f
+#define MAX_SCALING 1.3f
+#define COMMON_TOKEN_THRESHOLD 100
+#define HIGH_COMMON_PENALTY 0.7f
+#define LOW_COMMON_PENALTY 0.9f
+#define EARLY_STOP_STREAK_THRESHOLD 15
+#define MIN_RESPONSE_TOKENS 8
+
+// Knobs the engine reads at the start of every turn. Defaults reproduce the
+// compiled-in constants above, so an empty profile file changes nothing.
+struct SamplingConfig {
+    int top_k = TOP_K;
+    float top_p = TOP_P;
+    float temp = TEMP;
+    bool greedy = true;                 // Greedy pick after the chain; false = seeded random draw
+    uint32_t seed = 1234;               // Used when greedy is off
+    float zipf_strength = 1.0f;         // Scale on every ZipfAccelerator bias
+    float repeat_penalty = 1.0f;        // Base of ZipfAccelerator's repetition penalty; 1.0 = off
+    int min_response_tokens = MIN_RESPONSE_TOKENS;  // Floor under any mode's minimum
+    int max_output_tokens = DEFAULT_MAX_OUTPUT_TOKENS;  // Ceiling over any mode's maximum
+    int min_tokens = -1;                // Overrides the personality mode's min_tokens when >= 0
+    int max_tokens = -1;                // Overrides the personality mode's max_tokens when >= 0
+
+    // Returns false for an unknown key or a malformed value
+    bool set(const std::string& key, const std::string& value) {
+        char* end = nullptr;
+        double v = std::strtod(value.c_str(), &end);
+        bool numeric = end && end != value.c_str() && *end == '\0';
+
+        if (key == "greedy") {
+            if (value == "true" || value == "1") greedy = true;
+            else if (value == "false" || value == "0") greedy = false;
+            else return false;
+            return true;
+        }
+        if (!numeric) return false;
+
+        if (key == "top_k") top_k = (int)v;
+        else if (key == "top_p") top_p = (float)v;
+        else if (key == "temp") temp = (float)v;
+        else if (key == "seed") seed = (uint32_t)v;
+        else if (key == "zipf_strength") zipf_strength = (float)v;
+        else if (key == "repeat_penalty") repeat_penalty = (float)v;
+        else if (key == "min_response_tokens") min_response_tokens = (int)v;
+        else if (key == "max_output_tokens") max_output_tokens = (int)v;
+        else if (key == "min_tokens") min_tokens = (int)v;
+        else if (key == "max_tokens") max_tokens = (int)v;
+        else return false;
+        return true;
+    }
+
+    // Token bounds for a turn in a mode with the given persona limits
+    int effective_min_tokens(int mode_min) const {
+        return std::max(min_response_tokens, min_tokens >= 0 ? min_tokens : mode_min);
+    }
+    int effective_max_tokens(int mode_max) const {
+        return std::min(max_output_tokens, max_tokens >= 0 ? max_tokens : mode_max);
+    }
+};
+
+// Overrides keyed by section: "*", "*/<mode>", "<npc>", "<npc>/<mode>",
+// applied in that order so the most specific section wins. File format:
+//
+//   # comment
+//   [*]
+//   temp = 0.7
+//   [Krackle/rude]
+//   max_tokens = 40
+class SamplingProfiles {
+private:
+    using Overrides = std::vector<std::pair<std::string, std::string>>;
+    std::map<std::string, Overrides> sections;
+
+    static std::string trim(const std::string& s) {
+        size_t b = s.find_first_not_of(" \t\r");
+        if (b == std::string::npos) return "";
+        size_t e = s.find_last_not_of(" \t\r");
+        return s.substr(b, e - b + 1);
+    }
+
+    void apply_section(SamplingConfig& cfg, const std::string& name) const {
+        auto it = sections.find(name);
+        if (it == sections.end()) return;
+        for (const auto& [key, value] : it->second) cfg.set(key, value);
+    }
+
+public:
+    // Validates every key against SamplingConfig; on failure `error` names the line
+    bool load(const std::string& path, std::string& error) {
+        std::ifstream in(path);
+        if (!in) {
+            error = "cannot open " + path;
+            return false;
+        }
+        std::string section = "*";
+        std::string line;
+        for (int line_no = 1; std::getline(in, line); ++line_no) {
+            line = trim(line.substr(0, line.find('#')));
+            if (line.empty()) continue;
+            if (line.front() == '[' && line.back() == ']') {
+                section = trim(line.substr(1, line.size() - 2));
+                continue;
+            }
+            size_t eq = line.find('=');
+            SamplingConfig probe;
+            std::string key = trim(line.substr(0, eq));
+            std::string value = (eq == std::string::npos) ? "" : trim(line.substr(eq + 1));
+            if (eq == std::string::npos || !probe.set(key, value)) {
+                error = path + ":" + std::to_string(line_no) + ": bad setting '" + line + "'";
+                return false;
+            }
+            sections[section].emplace_back(key, value);
+        }
+        return true;
+    }
+
+    void set(const std::string& section, const std::string& key, const std::string& value) {
+        sections[section].emplace_back(key, value);
+    }
+
+    SamplingConfig resolve(const std::string& npc, const std::string& mode) const {
+        SamplingConfig cfg;
+        apply_section(cfg, "*");
+        apply_section(cfg, "*/" + mode);
+        apply_section(cfg, npc);
+        apply_section(cfg, npc + "/" + mode);
+        return cfg;
+    }
+};
@@ -0,0 +1,265 @@
+// selftest.h - Engine checks against the mock backend (--selftest); no model needed
+#pragma once
+
+#include "engine.h"
+#include "backend.h"
+#include "coalesce.h"
+#include <vector>
+#include <string>
+#include <memory>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+namespace selftest {
+
+#define SELFTEST_MOCK_SPEED 50.0    // Mock compute shrunk so every check finishes in well under a second
+
+class Checks {
+private:
+    std::ostream& out;
+    int passed = 0;
+    int failed = 0;
+
+public:
+    explicit Checks(std::ostream& o) : out(o) {}
+
+    void expect(bool ok, const std::string& what) {
+        (ok ? passed : failed)++;
+        out << (ok ? "  ok    " : "  FAIL  ") << what << "\n";
+    }
+
+    int summary() {
+        out << passed << " passed, " << failed << " failed\n";
+        return failed ? 1 : 0;
+    }
+};
+
+inline DialogueEngine::BackendFactory mock_factory(int slots) {
+    MockTiming timing = MockTiming{}.scaled(SELFTEST_MOCK_SPEED);
+    return [=] { return std::make_unique<MockBackend>(slots, timing); };
+}
+
+inline TurnRequest make_turn(const std::string& session, const std::string& player, const std::string& utterance) {
+    TurnRequest req;
+    req.session_id = session;
+    req.npc_idx = 0;
+    req.state = { player, "warrior", "stranger", 5, "greet" };
+    req.utterance = utterance;
+    return req;
+}
+
+// Feeds `pieces` through a one-follower FanOut led by `leader`; returns (streamed, final text)
+inline std::pair<std::string, std::string> fan_out(const std::string& leader, const std::string& follower,
+                                                   const std::vector<std::string>& pieces) {
+    FanOut group("key", leader, 1);
+    auto f = std::make_unique<FanOut::Follower>();
+    std::string streamed;
+    f->player_name = follower;
+    f->on_piece = [&streamed](const std::string& piece) { streamed += piece; };
+    std::future<TurnResult> result = f->promise.get_future();
+    group.join(std::move(f));
+    TurnResult leader_result;
+    for (const std::string& piece : pieces) {
+        group.publish(piece);
+        leader_result.text += piece;
+    }
+    group.complete(leader_result);
+    return { streamed, result.get().text };
+}
+
+inline void coalescing(Checks& c) {
+    auto [streamed, text] = fan_out("Ann", "Bob", { "An", "n, Anna plan", "ned it. An", "n's turn, An", "n" });
+    c.expect(streamed == "Bob, Anna planned it. Bob's turn, Bob", "fan-out streams the follower's name only as a whole word");
+    c.expect(text == streamed, "fan-out final text matches what was streamed");
+    c.expect(fan_out("Ann", "Bob", { "Hello Ann", "a" }).second == "Hello Anna", "a name split across pieces is not swapped inside a longer word");
+
+    // Submitted before start(), so the first of each pair is still queued when the second arrives
+    EngineConfig cfg;
+    cfg.coalesce = CoalescePolicy::ALWAYS;
+    DialogueEngine engine(mock_factory(1), cfg);
+    auto lead = engine.submit(make_turn("ann@gate", "Ann", "Open the gate!"));
+    auto same = engine.submit(make_turn("bob@gate", "Bob", "open the  gate"));
+    TurnRequest higher = make_turn("cid@gate", "Cid", "Open the gate!");
+    higher.state.player_level = 20;
+    auto other_level = engine.submit(std::move(higher));
+    if (!engine.start()) {
+        c.expect(false, "mock engine starts");
+        return;
+    }
+    TurnResult a = lead.get(), b = same.get(), d = other_level.get();
+    engine.stop();
+    c.expect(!a.coalesced && b.coalesced && b.text == a.text, "identical turns share one generation");
+    c.expect(!d.coalesced, "a different player level gets its own generation");
+
+    // Followers' conversations take the shared reply as their own: Dan's next
+    // turn waits for it, and Fay's history matches Cid's afterwards
+    DialogueEngine chat(mock_factory(2), cfg);
+    std::mutex log_mutex;
+    std::string log;    // One tag per streamed piece
+    auto tagged = [&](char tag) {
+        return [&, tag](const std::string&) {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            log += tag;
+        };
+    };
+    auto cid = chat.submit(make_turn("cid@gate", "Cid", "Open the gate!"));
+    TurnRequest joins = make_turn("dan@gate", "Dan", "Open the gate!");
+    joins.on_piece = tagged('f');
+    auto dan = chat.submit(std::move(joins));
+    TurnRequest after = make_turn("dan@gate", "Dan", "Who rules here?");
+    after.on_piece = tagged('n');
+    auto dan_next = chat.submit(std::move(after));
+    auto fay = chat.submit(make_turn("fay@gate", "Fay", "Open the gate!"));
+    if (!chat.start()) {
+        c.expect(false, "mock engine starts");
+        return;
+    }
+    cid.get();
+    bool followed = dan.get().coalesced && fay.get().coalesced;
+    dan_next.get();
+    c.expect(followed && log.find('f') != std::string::npos && log.find('n') > log.rfind('f'),
+             "a follower's next turn waits until the shared reply is delivered");
+    auto cid_again = chat.submit(make_turn("cid@gate", "Cid", "Who rules here?"));
+    auto fay_again = chat.submit(make_turn("fay@gate", "Fay", "Who rules here?"));
+    cid_again.get();
+    bool shared_history = fay_again.get().coalesced;
+    chat.stop();
+    c.expect(shared_history, "a follower's history includes the shared reply");
+}
+
+// Replies to `lines` from a fresh mock engine, in submission order
+inline std::vector<TurnResult> replies(EngineConfig cfg, const std::vector<std::string>& lines, EngineStats& stats) {
+    DialogueEngine engine(mock_factory(cfg.slots_per_worker), cfg, mock_factory(1));
+    std::vector<TurnResult> out;
+    if (!engine.start()) return out;
+    std::vector<std::future<TurnResult>> pending;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        pending.push_back(engine.submit(make_turn("p" + std::to_string(i) + "@gate", "Player" + std::to_string(i), lines[i])));
+    }
+    for (auto& f : pending) out.push_back(f.get());
+    stats = engine.stats();
+    engine.stop();
+    return out;
+}
+
+inline void prefill_handoff(Checks& c) {
+    const std::vector<std::string> lines = { "May I enter the castle?", "What news from court?", "Who rules here?",
+                                             "Have you seen my friend?", "Any rumors lately?", "Where is the road?" };
+    EngineConfig cfg;
+    cfg.coalesce = CoalescePolicy::OFF;
+    cfg.slots_per_worker = 2;
+    EngineStats local_stats, handoff_stats;
+    std::vector<TurnResult> local = replies(cfg, lines, local_stats);
+    cfg.prefill_workers = 1;
+    std::vector<TurnResult> handed = replies(cfg, lines, handoff_stats);
+
+    bool all_ok = local.size() == lines.size() && handed.size() == lines.size();
+    bool same = all_ok;
+    for (size_t i = 0; all_ok && i < lines.size(); ++i) {
+        all_ok = local[i].error.empty() && handed[i].error.empty() && handed[i].n_tokens > 0;
+        same = same && local[i].text == handed[i].text && local[i].n_prompt == handed[i].n_prompt;
+    }
+    c.expect(all_ok, "every turn completes with prefill workers");
+    c.expect(handoff_stats.handoffs == lines.size() && local_stats.handoffs == 0, "each turn is handed off exactly once");
+    c.expect(handoff_stats.handoff_bytes > 0, "handoffs carry the sequence state");
+    c.expect(same, "a handed-off sequence decodes the same reply as one prefilled in place");
+}
+
+inline void tenant_sharing(Checks& c) {
+    TenantTable table;
+    table.set_policy("capped", { 1.0, 0.5 });
+    for (int i = 0; i < 3; ++i) table.on_submit("capped");
+    table.on_admit("capped");
+    table.on_admit("capped");
+    c.expect(!table.can_admit("capped", 4), "a tenant at its KV quota is passed over");
+    table.on_finish("capped", 10, 20, 0.0, 1.0);
+    c.expect(table.can_admit("capped", 4), "finishing a turn frees quota");
+
+    // One slot, so admissions are serial; every turn is queued before start()
+    EngineConfig cfg;
+    cfg.coalesce = CoalescePolicy::OFF;
+    DialogueEngine engine(mock_factory(1), cfg);
+    engine.set_tenant_policy("heavy", { 3.0, 1.0 });
+    engine.set_tenant_policy("light", { 1.0, 1.0 });
+    std::mutex order_mutex;
+    std::vector<std::string> order;     // Tenant of each turn, in the order their first piece arrived
+    std::vector<std::future<TurnResult>> pending;
+    for (const char* tenant : { "heavy", "light" }) {
+        for (int i = 0; i < 8; ++i) {
+            TurnRequest req = make_turn(std::string(tenant) + "/p" + std::to_string(i), "Player" + std::to_string(i), "What news?");
+            req.tenant = tenant;
+            auto first = std::make_shared<bool>(true);
+            req.on_piece = [&, first, tenant](const std::string&) {
+                if (!*first) return;
+                *first = false;
+                std::lock_guard<std::mutex> lock(order_mutex);
+                order.push_back(tenant);
+            };
+            pending.push_back(engine.submit(std::move(req)));
+        }
+    }
+    if (!engine.start()) {
+        c.expect(false, "mock engine starts");
+        return;
+    }
+    for (auto& f : pending) f.get();
+    engine.stop();
+    long heavy_first = std::count(order.begin(), order.begin() + std::min<size_t>(8, order.size()), "heavy");
+    c.expect(order.size() == 16 && heavy_first >= 5 && heavy_first <= 7,
+             "weight 3:1 gives the heavy tenant 5-7 of the first 8 slots although it queued all 8 first (got " +
+             std::to_string(heavy_first) + ")");
+
+    // Four slots, but the capped tenant may hold only two of them
+    DialogueEngine quota_engine(mock_factory(4), cfg);
+    quota_engine.set_tenant_policy("capped", { 1.0, 0.5 });
+    pending.clear();
+    for (int i = 0; i < 8; ++i) {
+        TurnRequest req = make_turn("capped/p" + std::to_string(i), "Player" + std::to_string(i), "What news?");
+        req.tenant = "capped";
+        pending.push_back(quota_engine.submit(std::move(req)));
+    }
+    TurnRequest other = make_turn("free/p0", "Player0", "What news?");
+    other.tenant = "free";
+    auto free_turn = quota_engine.submit(std::move(other));
+    if (!quota_engine.start()) {
+        c.expect(false, "mock engine starts");
+        return;
+    }
+    int most_in_flight = 0;
+    auto busy = [&] {
+        return std::any_of(pending.begin(), pending.end(), [](std::future<TurnResult>& f) {
+            return f.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+        });
+    };
+    while (busy()) {
+        for (const TenantStats& t : quota_engine.tenant_stats()) {
+            if (t.name == "capped") most_in_flight = std::max(most_in_flight, t.in_flight);
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    TurnResult free_result = free_turn.get();
+    double capped_wait_ms = 0.0;
+    for (auto& f : pending) capped_wait_ms = std::max(capped_wait_ms, f.get().queue_ms);
+    quota_engine.stop();
+    c.expect(most_in_flight == 2, "a tenant with kv_share 0.5 holds at most 2 of 4 slots (peak " +
+             std::to_string(most_in_flight) + ")");
+    c.expect(free_result.error.empty() && free_result.queue_ms < capped_wait_ms,
+             "another tenant's turn is admitted while the capped one waits");
+}
+
+inline int run(std::ostream& out) {
+    Checks c(out);
+    out << "coalescing\n";
+    coalescing(c);
+    out << "prefill handoff\n";
+    prefill_handoff(c);
+    out << "tenant sharing\n";
+    tenant_sharing(c);
+    return c.summary();
+}
+
+} // namespace selftest
@@ -0,0 +1,190 @@
+// sweep.h - Sampling-parameter sweep: replay a script across a grid of SamplingConfig values
+#pragma once
+
+#include "engine.h"
+#include "sampling.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+
+#define SWEEP_COMPLETE_TARGET 0.9   // Share of replies that must end a sentence to be "best"
+
+// One player line: "npc|relationship|recent_action|utterance" (# starts a comment)
+struct ReplayLine {
+    int npc_idx = 0;
+    std::string relationship;
+    std::string recent_action;
+    std::string utterance;
+};
+
+using SamplingOverrides = std::vector<std::pair<std::string, std::string>>;
+
+inline bool load_replay(const std::string& path, std::vector<ReplayLine>& lines, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::string row;
+    for (int line_no = 1; std::getline(in, row); ++line_no) {
+        if (!row.empty() && row.back() == '\r') row.pop_back();
+        if (row.empty() || row[0] == '#') continue;
+        std::vector<std::string> fields;
+        std::stringstream ss(row);
+        std::string field;
+        while (fields.size() < 3 && std::getline(ss, field, '|')) fields.push_back(field);
+        std::getline(ss, field);
+        fields.push_back(field);
+        if (fields.size() != 4 || fields[3].empty()) {
+            error = path + ":" + std::to_string(line_no) + ": expected npc|relationship|recent_action|utterance";
+            return false;
+        }
+        ReplayLine line;
+        line.npc_idx = std::atoi(fields[0].c_str());
+        line.relationship = fields[1].empty() ? "stranger" : fields[1];
+        line.recent_action = fields[2];
+        line.utterance = fields[3];
+        lines.push_back(line);
+    }
+    if (lines.empty()) error = path + ": no replay lines";
+    return !lines.empty();
+}
+
+// "temp=0.6,0.8;top_k=20,40" -> the four combinations of those values
+inline bool parse_grid(const std::string& spec, std::vector<SamplingOverrides>& points, std::string& error) {
+    points.assign(1, SamplingOverrides{});
+    std::stringstream axes(spec);
+    std::string axis;
+    while (std::getline(axes, axis, ';')) {
+        if (axis.empty()) continue;
+        size_t eq = axis.find('=');
+        if (eq == std::string::npos) {
+            error = "bad grid axis '" + axis + "' (want key=v1,v2,...)";
+            return false;
+        }
+        std::string key = axis.substr(0, eq);
+        std::vector<std::string> values;
+        std::stringstream vs(axis.substr(eq + 1));
+        std::string v;
+        while (std::getline(vs, v, ',')) {
+            SamplingConfig probe;
+            if (!probe.set(key, v)) {
+                error = "bad grid value " + key + "=" + v;
+                return false;
+            }
+            values.push_back(v);
+        }
+
+        std::vector<SamplingOverrides> expanded;
+        for (const auto& point : points) {
+            for (const auto& value : values) {
+                SamplingOverrides next = point;
+                next.emplace_back(key, value);
+                expanded.push_back(next);
+            }
+        }
+        points.swap(expanded);
+    }
+    return true;
+}
+
+class SamplingSweep {
+private:
+    struct PointResult {
+        std::string label;
+        int turns = 0;
+        long long tokens = 0;
+        int complete = 0;               // Replies ending in . ! or ?
+        std::vector<double> latency_ms;
+        std::map<std::string, int> stops;
+    };
+
+    static std::string label_for(const SamplingOverrides& point) {
+        if (point.empty()) return "(defaults)";
+        std::string label;
+        for (const auto& [key, value] : point) label += (label.empty() ? "" : " ") + key + "=" + value;
+        return label;
+    }
+
+    static bool ends_sentence(const std::string& text) {
+        size_t end = text.find_last_not_of(" \n\"'");
+        return end != std::string::npos && std::string(".!?").find(text[end]) != std::string::npos;
+    }
+
+public:
+    // Replays every line once per grid point (each point gets fresh conversations)
+    void run(DialogueEngine& engine, const std::vector<ReplayLine>& replay,
+             const std::vector<SamplingOverrides>& grid, std::ostream& out) {
+        std::vector<PointResult> results;
+
+        for (size_t g = 0; g < grid.size(); ++g) {
+            PointResult r;
+            r.label = label_for(grid[g]);
+            for (const ReplayLine& line : replay) {
+                TurnRequest req;
+                req.npc_idx = std::clamp(line.npc_idx, 0, (int)NPCS.size() - 1);
+                req.session_id = "sweep" + std::to_string(g) + "@" + NPCS[req.npc_idx].name;
+                req.state.player_name = "Traveler";
+                req.state.player_class = "ranger";
+                req.state.player_level = 5;
+                req.state.relationship = line.relationship;
+                req.state.recent_action = line.recent_action;
+                req.utterance = line.utterance;
+                req.sampling_overrides = grid[g];
+
+                TurnResult t = engine.submit(std::move(req)).get();
+                r.turns++;
+                r.tokens += t.n_tokens;
+                r.latency_ms.push_back(t.total_ms);
+                r.stops[stop_reason_name(t.stop)]++;
+                if (t.error.empty() && ends_sentence(t.text)) r.complete++;
+            }
+            out << "  [" << g + 1 << "/" << grid.size() << "] " << r.label << "\n";
+            results.push_back(std::move(r));
+        }
+
+        out << std::fixed << "\n=== Sampling sweep: " << replay.size() << " lines x "
+            << grid.size() << " configs ===\n";
+        out << "  " << std::left << std::setw(36) << "config" << std::right
+            << std::setw(10) << "tok/reply" << std::setw(10) << "complete"
+            << std::setw(10) << "ms/turn" << std::setw(9) << "p95 ms" << "  stops\n";
+
+        const PointResult* best = nullptr;
+        for (PointResult& r : results) {
+            double mean_tokens = (double)r.tokens / std::max(r.turns, 1);
+            double complete = (double)r.complete / std::max(r.turns, 1);
+            double mean_ms = 0.0;
+            for (double ms : r.latency_ms) mean_ms += ms;
+            mean_ms /= std::max<size_t>(r.latency_ms.size(), 1);
+            std::sort(r.latency_ms.begin(), r.latency_ms.end());
+            double p95 = r.latency_ms.empty() ? 0.0
+                : r.latency_ms[std::min(r.latency_ms.size() - 1, (size_t)(0.95 * r.latency_ms.size()))];
+
+            out << "  " << std::left << std::setw(36) << r.label << std::right << std::setprecision(1)
+                << std::setw(10) << mean_tokens << std::setw(9) << 100.0 * complete << "%"
+                << std::setprecision(0) << std::setw(10) << mean_ms << std::setw(9) << p95 << " ";
+            for (const auto& [name, count] : r.stops) {
+                out << " " << name << " " << std::setprecision(0) << 100.0 * count / r.turns << "%";
+            }
+            out << "\n";
+
+            if (complete >= SWEEP_COMPLETE_TARGET &&
+                (!best || r.tokens * best->turns < best->tokens * r.turns)) {
+                best = &r;
+            }
+        }
+
+        if (best) {
+            out << "\n  fewest tokens with >= " << (int)(SWEEP_COMPLETE_TARGET * 100)
+                << "% complete sentences: " << best->label << "\n";
+        } else {
+            out << "\n  no config reached " << (int)(SWEEP_COMPLETE_TARGET * 100) << "% complete sentences\n";
+        }
+    }
+};
@@ -0,0 +1,158 @@
+// tenants.h - Weighted fair sharing of decode slots between game shards (tenants)
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#define TENANT_DEFAULT "default"        // Tenant of turns that name none
+#define TENANT_PROMPT_COST 0.1          // Slot time of a prompt token, in generated tokens
+#define TENANT_INITIAL_COST 64.0        // Turn cost assumed before a tenant has finished any
+#define TENANT_TTFT_SAMPLES 1024        // Recent turns behind each tenant's TTFT percentiles
+
+struct TenantPolicy {
+    double weight = 1.0;        // Share of slot time relative to other busy tenants
+    double kv_share = 1.0;      // Most of the engine's slots (each a fixed KV region) held at once
+};
+
+struct TenantStats {
+    std::string name;
+    double weight = 1.0;
+    int queued = 0;
+    int in_flight = 0;          // Admitted and not yet finished
+    int max_in_flight = 0;      // Quota at the current slot count
+    uint64_t turns = 0;
+    uint64_t tokens = 0;        // Generated
+    double queue_ms = 0.0;      // Mean submit -> admitted
+    double ttft_p50_ms = 0.0;
+    double ttft_p95_ms = 0.0;
+};
+
+// Start-time fair queuing over turns. Each tenant has a virtual clock that
+// advances by a turn's cost (prompt and generated tokens) divided by the
+// tenant's weight; a free slot goes to the waiting tenant whose clock is
+// furthest behind. A turn is charged an estimate when admitted and trued up
+// when it finishes. A tenant that was idle restarts at the system clock, so
+// idleness earns no burst. Not thread-safe: the engine calls it under its lock.
+class TenantTable {
+private:
+    struct Tenant {
+        TenantPolicy policy;
+        double vtime = 0.0;
+        double avg_cost = TENANT_INITIAL_COST;
+        int queued = 0;
+        int in_flight = 0;
+        uint64_t turns = 0;
+        uint64_t tokens = 0;
+        double queue_ms_total = 0.0;
+        std::vector<double> ttft_ms;    // Ring of TENANT_TTFT_SAMPLES
+        size_t ttft_next = 0;
+    };
+
+    std::map<std::string, Tenant> tenants;
+    std::map<std::string, TenantPolicy> policies;   // Applied to tenants as they appear
+    double system_vtime = 0.0;          // Start tag of the last admitted turn
+
+    Tenant& get(const std::string& name) {
+        auto it = tenants.find(name);
+        if (it == tenants.end()) {
+            it = tenants.emplace(name, Tenant{}).first;
+            auto p = policies.find(name);
+            if (p != policies.end()) it->second.policy = p->second;
+        }
+        return it->second;
+    }
+
+    const Tenant& find(const std::string& name) const {
+        static const Tenant unknown;
+        auto it = tenants.find(name);
+        return it == tenants.end() ? unknown : it->second;
+    }
+
+    static double percentile(std::vector<double> v, double p) {
+        if (v.empty()) return 0.0;
+        size_t k = std::min(v.size() - 1, (size_t)(p * v.size()));
+        std::nth_element(v.begin(), v.begin() + k, v.end());
+        return v[k];
+    }
+
+    static int quota(const Tenant& t, int total_slots) {
+        return std::max(1, (int)std::floor(t.policy.kv_share * total_slots + 1e-9));
+    }
+
+public:
+    static const std::string& name_of(const std::string& tenant) {
+        static const std::string fallback = TENANT_DEFAULT;
+        return tenant.empty() ? fallback : tenant;
+    }
+
+    void set_policy(const std::string& name, TenantPolicy policy) {
+        policy.weight = std::max(policy.weight, 1e-3);
+        policy.kv_share = std::clamp(policy.kv_share, 0.0, 1.0);
+        policies[name] = policy;
+        auto it = tenants.find(name);
+        if (it != tenants.end()) it->second.policy = policy;
+    }
+
+    void on_submit(const std::string& name) {
+        Tenant& t = get(name);
+        if (t.queued == 0 && t.in_flight == 0) t.vtime = std::max(t.vtime, system_vtime);
+        t.queued++;
+    }
+
+    // Waiting turns of a tenant at its KV quota are passed over
+    bool can_admit(const std::string& name, int total_slots) const {
+        const Tenant& t = find(name);
+        return t.in_flight < quota(t, total_slots);
+    }
+
+    double vtime(const std::string& name) const { return find(name).vtime; }
+
+    void on_admit(const std::string& name) {
+        Tenant& t = get(name);
+        system_vtime = std::max(system_vtime, t.vtime);
+        t.vtime += t.avg_cost / t.policy.weight;
+        t.queued--;
+        t.in_flight++;
+    }
+
+    void on_finish(const std::string& name, int n_prompt, int n_tokens, double queue_ms, double ttft_ms) {
+        Tenant& t = get(name);
+        double cost = n_prompt * TENANT_PROMPT_COST + n_tokens;
+        t.vtime += (cost - t.avg_cost) / t.policy.weight;
+        t.avg_cost = 0.9 * t.avg_cost + 0.1 * cost;
+        t.in_flight--;
+        t.turns++;
+        t.tokens += n_tokens;
+        t.queue_ms_total += queue_ms;
+        if (ttft_ms <= 0.0) return;
+        if (t.ttft_ms.size() < TENANT_TTFT_SAMPLES) {
+            t.ttft_ms.push_back(ttft_ms);
+        } else {
+            t.ttft_ms[t.ttft_next] = ttft_ms;
+            t.ttft_next = (t.ttft_next + 1) % TENANT_TTFT_SAMPLES;
+        }
+    }
+
+    std::vector<TenantStats> stats(int total_slots) const {
+        std::vector<TenantStats> out;
+        for (const auto& [name, t] : tenants) {
+            TenantStats s;
+            s.name = name;
+            s.weight = t.policy.weight;
+            s.queued = t.queued;
+            s.in_flight = t.in_flight;
+            s.max_in_flight = quota(t, total_slots);
+            s.turns = t.turns;
+            s.tokens = t.tokens;
+            s.queue_ms = t.turns ? t.queue_ms_total / t.turns : 0.0;
+            s.ttft_p50_ms = percentile(t.ttft_ms, 0.50);
+            s.ttft_p95_ms = percentile(t.ttft_ms, 0.95);
+            out.push_back(std::move(s));
+        }
+        return out;
+    }
+};
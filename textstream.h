@@ -0,0 +1,133 @@
+// textstream.h - Streaming NPC reply cleanup: sanitize, collapse spaces, cut at speaker cues, strip quotes
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <algorithm>
+
+#define REPLY_STREAM_RESERVE 4096   // Bytes reserved up front; replies stay well under it
+#define REPLY_SENTENCE_KEEP 0.7     // Trim back to the last . ! ? only when it is past this share
+#define REPLY_FALLBACK "I... I'm not sure what to say."
+
+// Cleans a reply piece by piece as tokens are sampled, so the end of a turn
+// only has to slice the buffer. Same rules as the old whole-string pass:
+// bytes outside printable ASCII (except \n) become spaces, runs of spaces
+// collapse to one, the reply is cut at the first speaker cue past position
+// 0, trimmed to its last sentence if that is near the end, and unwrapped
+// from quotes. Each byte is classified once; cue search looks only at the
+// bytes a piece added plus a cue-length overlap. Pieces are a few bytes and
+// cues must be seen as soon as they arrive, so there is no block-wise path.
+class ReplyStream {
+private:
+    static constexpr size_t npos = std::string_view::npos;
+
+    // Cut the final text at these (case-sensitive) plus "<player>:"
+    static constexpr std::array<std::string_view, 8> CUT_CUES = {
+        "Adventurer:", "User:", "You say", "### Input:", "### Instruction:",
+        "### Response:", "### Assistant:", "### Human:"
+    };
+    // End the turn on these (case-insensitive) plus "<player>:"
+    static constexpr std::array<std::string_view, 2> STOP_CUES = { "you say", "adventurer:" };
+
+    std::string out;                    // Sanitized text so far
+    std::string player_cut_cue;         // "<player>:"
+    std::string player_stop_cue;        // Lower-cased "<player>:"
+    size_t max_cue_len = 0;
+    size_t scanned = 0;                 // out[0, scanned) has been searched for cues
+    size_t cut = npos;                  // Earliest cut cue seen
+    size_t last_sentence_end = npos;    // Index of the last . ! or ?
+    bool last_was_space = true;         // Starts true so leading spaces are dropped
+    bool stop_seen = false;
+
+    static bool is_sentence_end(unsigned char c) { return c == '.' || c == '!' || c == '?'; }
+
+    static size_t find_nocase(std::string_view hay, std::string_view needle, size_t from) {
+        if (needle.empty() || hay.size() < needle.size()) return npos;
+        for (size_t i = from; i + needle.size() <= hay.size(); ++i) {
+            size_t k = 0;
+            while (k < needle.size() && (char)std::tolower((unsigned char)hay[i + k]) == needle[k]) ++k;
+            if (k == needle.size()) return i;
+        }
+        return npos;
+    }
+
+    void push(const char* p, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            unsigned char c = p[i];
+            if (c == '\n' || (c > 32 && c <= 126)) {
+                if (is_sentence_end(c)) last_sentence_end = out.size();
+                out.push_back((char)c);
+                last_was_space = false;
+            } else if (!last_was_space) {
+                out.push_back(' ');
+                last_was_space = true;
+            }
+        }
+    }
+
+    void scan_cues() {
+        std::string_view text(out);
+        size_t from = (scanned + 1 > max_cue_len) ? scanned + 1 - max_cue_len : 0;
+
+        auto check_cut = [&](std::string_view cue) {
+            size_t pos = text.find(cue, std::max<size_t>(from, 1));
+            if (pos != npos && pos < cut) cut = pos;
+        };
+        for (std::string_view cue : CUT_CUES) check_cut(cue);
+        check_cut(player_cut_cue);
+
+        if (!stop_seen) {
+            for (std::string_view cue : STOP_CUES) stop_seen |= find_nocase(text, cue, from) != npos;
+            stop_seen |= find_nocase(text, player_stop_cue, from) != npos;
+        }
+        scanned = out.size();
+    }
+
+public:
+    ReplyStream() { out.reserve(REPLY_STREAM_RESERVE); }
+
+    // Start a new reply; keeps the buffer's capacity
+    void reset(std::string_view player_name) {
+        out.clear();
+        player_cut_cue.assign(player_name).append(":");
+        player_stop_cue = player_cut_cue;
+        for (char& c : player_stop_cue) c = (char)std::tolower((unsigned char)c);
+
+        max_cue_len = player_cut_cue.size();
+        for (std::string_view cue : CUT_CUES) max_cue_len = std::max(max_cue_len, cue.size());
+        scanned = 0;
+        cut = npos;
+        last_sentence_end = npos;
+        last_was_space = true;
+        stop_seen = false;
+    }
+
+    void feed(std::string_view piece) {
+        push(piece.data(), piece.size());
+        scan_cues();
+    }
+
+    // The model has started writing someone else's line
+    bool stop_cue_seen() const { return stop_seen; }
+
+    // Final reply text; valid until the next reset() or feed()
+    std::string_view finish() const {
+        std::string_view text(out);
+        if (cut != npos) text = text.substr(0, cut);
+
+        // Try to end at a complete sentence
+        size_t end = last_sentence_end;
+        if (end != npos && end >= text.size()) end = text.find_last_of(".!?");
+        if (end != npos && end > text.size() * REPLY_SENTENCE_KEEP) text = text.substr(0, end + 1);
+
+        if (text.empty() || text == "\"") return REPLY_FALLBACK;
+
+        // Remove leading/trailing quotes if present
+        if (text.front() == '"') text.remove_prefix(1);
+        if (!text.empty() && text.back() == '"') text.remove_suffix(1);
+        return text;
+    }
+};
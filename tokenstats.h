@@ -0,0 +1,201 @@
+// tokenstats.h - Token statistics learned from live traffic, shared by every session RCU-style
+#pragma once
+
+#include "llama.h"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#define TOKEN_STATS_MERGE_MS 2000       // Merger period
+#define TOKEN_STATS_DECAY 0.9f          // Weight old counts keep per merge (half-life ~6.6 merges)
+#define TOKEN_STATS_MIN_WEIGHT 2000.0   // Decayed token mass needed before a bias is published
+#define TOKEN_STATS_GAIN 0.15f          // Bias = gain * log((count + mean) / (2 * mean)), mean over used tokens
+#define TOKEN_STATS_MAX_BIAS 0.5f       // Cap either way
+
+// Counts every sampled token across all sessions and turns the decayed
+// counts into a logit bias that all sessions read. The bias is centred: 0
+// at the mean count of used tokens, negative below it (about -0.1 for a
+// token never seen) and capped above, so it reshapes the distribution
+// rather than pushing up everything that has been sampled.
+//
+// Writers: each worker thread owns a Slot of relaxed counters that only it
+// increments (a load and a store, no read-modify-write). The merger thread
+// reads them and diffs against what it saw last time, so nothing is reset
+// and no update is lost.
+//
+// Readers: the bias is an immutable Snapshot behind an atomic pointer. A
+// reader announces the epoch it entered at, loads the pointer and leaves;
+// the merger frees a replaced snapshot only once no reader is still inside
+// an epoch from before the swap. Neither side ever waits on the other.
+class TokenStats {
+public:
+    struct Snapshot {
+        uint64_t version = 0;
+        double weight = 0.0;            // Decayed token mass behind this bias
+        std::vector<float> bias;        // Indexed by token id
+    };
+
+    class Slot {
+    private:
+        friend class TokenStats;
+        std::vector<std::atomic<uint32_t>> counts;
+        std::vector<uint32_t> merged;   // Merger-owned: counts at the last merge
+        std::atomic<uint64_t> epoch{0}; // 0 = not reading
+        TokenStats* owner;
+
+        Slot(TokenStats* o, int n_vocab) : counts(n_vocab), merged(n_vocab, 0), owner(o) {}
+
+    public:
+        // Called only from the owning thread
+        void record(llama_token token) {
+            std::atomic<uint32_t>& c = counts[token];
+            c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        // Pointer stays valid until leave(); nullptr until enough traffic was seen
+        const Snapshot* enter() {
+            epoch.store(owner->global_epoch.load());
+            return owner->current.load();
+        }
+        void leave() { epoch.store(0); }
+    };
+
+    // Scoped enter()/leave()
+    class Reader {
+    private:
+        Slot& slot;
+        const Snapshot* snap;
+    public:
+        explicit Reader(Slot& s) : slot(s), snap(s.enter()) {}
+        ~Reader() { slot.leave(); }
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+        const Snapshot* get() const { return snap; }
+    };
+
+private:
+    const int n_vocab;
+    std::vector<std::unique_ptr<Slot>> slots;   // Never shrinks; guarded by `mutex`
+    std::vector<double> decayed;                // Merger-owned
+    std::atomic<const Snapshot*> current{nullptr};
+    std::atomic<uint64_t> global_epoch{1};
+    std::deque<std::pair<uint64_t, const Snapshot*>> retired;  // (epoch it was replaced in, snapshot)
+    uint64_t n_merges = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    std::thread merger;
+
+    // Free every retired snapshot no reader can still hold
+    void reclaim() {
+        uint64_t oldest = UINT64_MAX;
+        for (const auto& s : slots) {
+            uint64_t e = s->epoch.load();
+            if (e != 0) oldest = std::min(oldest, e);
+        }
+        while (!retired.empty() && retired.front().first <= oldest) {
+            delete retired.front().second;
+            retired.pop_front();
+        }
+    }
+
+    void merge_locked() {
+        for (double& d : decayed) d *= TOKEN_STATS_DECAY;
+        for (const auto& s : slots) {
+            for (int t = 0; t < n_vocab; ++t) {
+                uint32_t now = s->counts[t].load(std::memory_order_relaxed);
+                decayed[t] += (uint32_t)(now - s->merged[t]);
+                s->merged[t] = now;
+            }
+        }
+        n_merges++;
+
+        double weight = 0.0;
+        int used = 0;
+        for (double d : decayed) {
+            weight += d;
+            used += d > 0.0;
+        }
+        if (weight >= TOKEN_STATS_MIN_WEIGHT) {
+            auto* snap = new Snapshot;
+            snap->version = n_merges;
+            snap->weight = weight;
+            snap->bias.resize(n_vocab);
+            const double mean = weight / std::max(used, 1);
+            for (int t = 0; t < n_vocab; ++t) {
+                float b = TOKEN_STATS_GAIN * (float)std::log((decayed[t] + mean) / (2.0 * mean));
+                snap->bias[t] = std::clamp(b, -TOKEN_STATS_MAX_BIAS, TOKEN_STATS_MAX_BIAS);
+            }
+            const Snapshot* old = current.exchange(snap);
+            uint64_t e = global_epoch.fetch_add(1) + 1;
+            if (old) retired.emplace_back(e, old);
+        }
+        reclaim();
+    }
+
+public:
+    explicit TokenStats(int vocab_size) : n_vocab(vocab_size), decayed(vocab_size, 0.0) {}
+
+    ~TokenStats() {
+        stop();
+        for (auto& [e, snap] : retired) delete snap;
+        delete current.load();
+    }
+
+    TokenStats(const TokenStats&) = delete;
+    TokenStats& operator=(const TokenStats&) = delete;
+
+    // One per writing thread; call outside the token loop
+    Slot* register_thread() {
+        std::lock_guard<std::mutex> lock(mutex);
+        slots.push_back(std::unique_ptr<Slot>(new Slot(this, n_vocab)));
+        return slots.back().get();
+    }
+
+    void start() {
+        merger = std::thread([this] {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping) {
+                cv.wait_for(lock, std::chrono::milliseconds(TOKEN_STATS_MERGE_MS), [this] { return stopping; });
+                merge_locked();
+            }
+        });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (merger.joinable()) merger.join();
+    }
+
+    // Merge immediately instead of waiting for the next period
+    void merge_now() {
+        std::lock_guard<std::mutex> lock(mutex);
+        merge_locked();
+    }
+
+    uint64_t merges() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return n_merges;
+    }
+
+    size_t memory_bytes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t bytes = decayed.capacity() * sizeof(double);
+        for (const auto& s : slots) bytes += s->counts.size() * sizeof(uint32_t) + s->merged.capacity() * sizeof(uint32_t);
+        size_t live = retired.size() + (current.load() ? 1 : 0);
+        return bytes + live * n_vocab * sizeof(float);
+    }
+};
@@ -0,0 +1,52 @@
+// turn.h - One player turn: what the engine is asked and what it answers
+#pragma once
+
+#include "npc.h"
+#include <string>
+#include <vector>
+#include <functional>
+
+enum class StopReason { EOS, CLOSING_QUOTE, FORBIDDEN_SPEAKER, MAX_TOKENS, SCRIPTED, ERROR };
+
+inline const char* stop_reason_name(StopReason r) {
+    switch (r) {
+        case StopReason::EOS: return "eos";
+        case StopReason::CLOSING_QUOTE: return "closing_quote";
+        case StopReason::FORBIDDEN_SPEAKER: return "forbidden_speaker";
+        case StopReason::MAX_TOKENS: return "max_tokens";
+        case StopReason::SCRIPTED: return "scripted";
+        default: return "error";
+    }
+}
+
+// One player line to one NPC
+struct TurnRequest {
+    std::string session_id;     // Conversation key; Zipf state persists per session
+    std::string tenant;         // Game shard sharing the engine; empty = TENANT_DEFAULT
+    int npc_idx = 0;
+    GameState state;
+    std::string utterance;
+    // key=value SamplingConfig settings applied on top of the NPC/mode profile
+    std::vector<std::pair<std::string, std::string>> sampling_overrides;
+    bool require_variety = false;   // Never answer with another player's identical turn
+    double display_cps = 0.0;       // Characters per second the reply is shown at; 0 = as generated
+    // Raw pieces as they are sampled, called on the engine's worker thread.
+    // Called on the submitting thread, inside submit(), when the turn joins
+    // a reply that is already streaming or is answered from an authored intent.
+    std::function<void(const std::string&)> on_piece;
+};
+
+struct TurnResult {
+    std::string text;           // Cleaned-up reply
+    std::string error;          // Non-empty when the turn failed
+    std::string mode;
+    StopReason stop = StopReason::ERROR;
+    int n_prompt = 0;
+    int n_tokens = 0;
+    double queue_ms = 0.0;      // Submit -> admitted to a slot
+    double ttft_ms = 0.0;       // Submit -> first token
+    double total_ms = 0.0;      // Submit -> finished
+    bool coalesced = false;     // Shared from an identical turn another player started
+    double stall_ms = 0.0;      // Paced turns: time the display had shown everything and waited
+    std::string intent;         // Authored intent that answered the turn; empty when generated
+};
@@ -10,22 +10,26 @@
 #include <string>
 #include <deque>
 #include <numeric>
+#include <memory>
 
 class ZipfAccelerator {
 private:
-    // Pre-computed token categories for O(1) lookup
-    std::vector<float> base_logit_bias;           // Per-token bias based on rank
-    std::unordered_set<llama_token> common_tokens; // Top 500 most frequent
-    std::unordered_set<llama_token> rare_tokens;   // Bottom 20% least frequent
-    std::unordered_set<llama_token> punctuation;   // Sentence enders
-    std::unordered_set<llama_token> dialogue_tokens; // Conversation-specific
+    // Pre-computed token categories for O(1) lookup. Built once by initialize()
+    // and never changed, so every copy of an accelerator shares them.
+    struct RankTables {
+        int vocab_size = 0;
+        std::vector<float> base_logit_bias;           // Per-token bias based on rank
+        std::unordered_set<llama_token> common_tokens; // Top 500 most frequent
+        std::unordered_set<llama_token> rare_tokens;   // Bottom 20% least frequent
+        std::unordered_set<llama_token> punctuation;   // Sentence enders
+        std::unordered_set<llama_token> dialogue_tokens; // Conversation-specific
+        std::vector<uint8_t> token_flags;  // Bit flags for O(1) category checks
+    };
+    std::shared_ptr<const RankTables> tables;   // Null until initialize()
     
     // Context-aware token sets (rebuilt per conversation turn)
     std::unordered_set<llama_token> current_role_tokens;
     std::unordered_set<llama_token> current_mood_tokens;
-    
-    int vocab_size;
-    bool initialized = false;
 
     // Conversation state tracking
     struct ConversationState {
@@ -43,9 +47,9 @@ private:
         float pattern_strength = 1.0f;
     } params;
 
-    // Add fast-path optimization
-    std::vector<uint8_t> token_flags;  // Bit flags for O(1) category checks
-    
+    // Runtime-tunable scale on every bias below (1.0 = as designed, 0.0 = off)
+    float bias_strength = 1.0f;
+
     // Flag bits
     static constexpr uint8_t IS_COMMON = 1;
     static constexpr uint8_t IS_RARE = 2;
@@ -54,64 +58,59 @@ private:
     
 public:
     // Fast initialization - only compute what we actually use␊
+    // Without corpus statistics, tokenizer merge scores stand in for frequency
     void initialize(const llama_vocab* vocab) {
-        vocab_size = vocab->n_tokens();
-        base_logit_bias.resize(vocab_size, 0.0f);
-        
-        // Build frequency ranking
-        std::vector<std::pair<llama_token, float>> token_scores;
-        token_scores.reserve(vocab_size);
-        
-        for (llama_token id = 0; id < vocab_size; ++id) {
-            float score = vocab->token_get_score(id);
-            token_scores.emplace_back(id, score);
-        }
-        
-        std::sort(token_scores.begin(), token_scores.end(), 
-                  [](const auto& a, const auto& b) { return a.second > b.second; });
+        std::vector<llama_token> rank_order(vocab->n_tokens());
+        std::iota(rank_order.begin(), rank_order.end(), 0);
+        std::sort(rank_order.begin(), rank_order.end(), [&](llama_token a, llama_token b) {
+            return vocab->token_get_score(a) > vocab->token_get_score(b);
+        });
+        initialize(vocab, rank_order);
+    }
+
+    // `rank_order` lists every token id, most frequent first (see corpusstats.h)
+    void initialize(const llama_vocab* vocab, const std::vector<llama_token>& rank_order) {
+        auto t = std::make_shared<RankTables>();
+        const int vocab_size = t->vocab_size = vocab->n_tokens();
+        t->base_logit_bias.assign(vocab_size, 0.0f);
         
         // Pre-compute categories and biases
-        common_tokens.clear();
-        rare_tokens.clear();
-        punctuation.clear();
-        dialogue_tokens.clear();
-        
         int common_cutoff = std::min(500, vocab_size / 10);
         int rare_cutoff = vocab_size * 4 / 5; // Bottom 20%
         
         for (int rank = 0; rank < vocab_size; ++rank) {
-            llama_token token = token_scores[rank].first;
+            llama_token token = rank_order[rank];
             std::string token_text = vocab->token_get_text(token);
             
             // Categorize tokens
             if (rank < common_cutoff) {
-                common_tokens.insert(token);
+                t->common_tokens.insert(token);
             }
             if (rank > rare_cutoff) {
-                rare_tokens.insert(token);
+                t->rare_tokens.insert(token);
             }
             
             // Find punctuation and dialogue markers
             if (token_text.find_first_of(".!?\"'") != std::string::npos) {
-                punctuation.insert(token);
+                t->punctuation.insert(token);
                 if (token_text.find('"') != std::string::npos) {
-                    dialogue_tokens.insert(token);
+                    t->dialogue_tokens.insert(token);
                 }
             }
             
             // Pre-compute Zipfian bias (more aggressive than current)
             float zipf_factor = 1.0f / std::pow(rank + 1.0f, 0.3f);
-            base_logit_bias[token] = std::log(zipf_factor);
+            t->base_logit_bias[token] = std::log(zipf_factor);
         }
         
         // Setup fast-path flags
-        token_flags.resize(vocab_size, 0);
-        for (llama_token token : common_tokens) token_flags[token] |= IS_COMMON;
-        for (llama_token token : rare_tokens) token_flags[token] |= IS_RARE;
-        for (llama_token token : punctuation) token_flags[token] |= IS_PUNCT;
-        for (llama_token token : dialogue_tokens) token_flags[token] |= IS_DIALOGUE;
+        t->token_flags.assign(vocab_size, 0);
+        for (llama_token token : t->common_tokens) t->token_flags[token] |= IS_COMMON;
+        for (llama_token token : t->rare_tokens) t->token_flags[token] |= IS_RARE;
+        for (llama_token token : t->punctuation) t->token_flags[token] |= IS_PUNCT;
+        for (llama_token token : t->dialogue_tokens) t->token_flags[token] |= IS_DIALOGUE;
         
-        initialized = true;
+        tables = std::move(t);
     }
     
     // Context-aware token set updates (called once per turn)
@@ -123,6 +122,7 @@ public:
         std::vector<std::string> role_keywords = get_role_keywords(role);
         std::vector<std::string> mood_keywords = get_mood_keywords(mood);
         
+        const int vocab_size = tables ? tables->vocab_size : 0;
         for (llama_token id = 0; id < vocab_size; ++id) {
             std::string token_text = vocab->token_get_text(id);
             std::string lower_text = to_lower(token_text);
@@ -155,17 +155,18 @@ public:
     void accelerate_logits(float* logits, int context_length, int min_tokens_remaining) {
         const int MAX_RESPONSE_LENGTH = 200; // Max response length for this context
 
-        if (!initialized) return;
+        if (!tables) return;
 
         // Apply base biases with dynamic scaling
-        for (int i = 0; i < vocab_size; ++i) {
-            logits[i] += base_logit_bias[i] * params.complexity_factor;
+        const float base_scale = params.complexity_factor * bias_strength;
+        for (int i = 0; i < tables->vocab_size; ++i) {
+            logits[i] += tables->base_logit_bias[i] * base_scale;
         }
 
         // Adaptive role/mood boosts based on engagement
-        float role_boost = 0.5f * params.engagement_modifier;
-        float mood_boost = 0.3f * params.engagement_modifier;
-        float dialogue_boost = 0.4f * params.pattern_strength;
+        float role_boost = 0.5f * params.engagement_modifier * bias_strength;
+        float mood_boost = 0.3f * params.engagement_modifier * bias_strength;
+        float dialogue_boost = 0.4f * params.pattern_strength * bias_strength;
 
         // Stronger boosts early in generation
         if (context_length < 10) {
@@ -194,8 +195,10 @@ public:
     
     // Fast quality check - returns true if token seems appropriate
     bool is_contextually_appropriate(llama_token token) const {
+        if (!tables) return false;
+
         // Quick rejection of very rare tokens
-        if (rare_tokens.count(token)) return false;
+        if (tables->rare_tokens.count(token)) return false;
         
         // Quick approval of role/mood tokens
         if (current_role_tokens.count(token) || current_mood_tokens.count(token)) {
@@ -203,14 +206,12 @@ public:
         }
         
         // Common tokens are generally OK
-        return common_tokens.count(token) > 0;
+        return tables->common_tokens.count(token) > 0;
     }
     
     // Adaptive repetition penalty based on token frequency
-    float get_repetition_penalty(llama_token token, int count) const {
-        float base_penalty = 0.9f; // Standard repetition penalty
-        
-        if (common_tokens.count(token)) {
+    float get_repetition_penalty(llama_token token, int count, float base_penalty = 0.9f) const {
+        if (tables && tables->common_tokens.count(token)) {
             // Common tokens can repeat more
             return std::pow(base_penalty, count * 0.7f);
         } else {
@@ -219,6 +220,8 @@ public:
         }
     }
 
+    void set_bias_strength(float strength) { bias_strength = strength; }
+
     // Record a generated sequence for adaptive state updates
     void record_generation(const std::vector<llama_token>& tokens) {
         // Track length history for complexity adjustments
@@ -233,7 +236,38 @@ public:
         }
     }
 
+    // Approximate heap bytes held by this conversation's own tables (allocator overhead included)
+    std::vector<std::pair<std::string, size_t>> memory_footprint() const {
+        size_t context_sets = hash_bytes(current_role_tokens) + hash_bytes(current_mood_tokens);
+        return {
+            { "zipf role/mood sets", context_sets },
+            { "zipf turn_frequencies", hash_bytes(conv_state.turn_frequencies) },
+        };
+    }
+
+    // The same for the rank tables, held once however many copies share them
+    std::vector<std::pair<std::string, size_t>> shared_footprint() const {
+        if (!tables) return {};
+        const RankTables& t = *tables;
+        size_t category_sets = hash_bytes(t.common_tokens) + hash_bytes(t.rare_tokens) +
+                               hash_bytes(t.punctuation) + hash_bytes(t.dialogue_tokens);
+        return {
+            { "zipf base_logit_bias", t.base_logit_bias.capacity() * sizeof(float) },
+            { "zipf token_flags", t.token_flags.capacity() * sizeof(uint8_t) },
+            { "zipf category sets", category_sets },
+        };
+    }
+
 private:
+    // Node-based hash containers: one bucket pointer per bucket plus one heap
+    // node (next pointer + value + malloc header, rounded to 16 bytes) per entry
+    template <typename Container>
+    static size_t hash_bytes(const Container& c) {
+        size_t node = sizeof(void*) + sizeof(typename Container::value_type) + sizeof(size_t);
+        node = std::max<size_t>(32, (node + 15) & ~size_t(15));
+        return c.bucket_count() * sizeof(void*) + c.size() * node;
+    }
+
     std::string to_lower(const std::string& s) const {
         std::string result = s;
         std::transform(result.begin(), result.end(), result.begin(), ::tolower);
@@ -290,21 +324,21 @@ private:
         // Boost frequently used tokens in successful exchanges
         for (const auto& [token, freq] : conv_state.turn_frequencies) {
             if (freq > 0.1f) {  // Token appears in >10% of successful turns
-                logits[token] += 0.2f * params.pattern_strength;
+                logits[token] += 0.2f * params.pattern_strength * bias_strength;
             }
         }
     }
 
     void suppress_dialogue_enders(float* logits) {
-        for (llama_token token : dialogue_tokens) {
-            if (punctuation.count(token)) {
-                logits[token] -= 2.0f;
+        for (llama_token token : tables->dialogue_tokens) {
+            if (tables->punctuation.count(token)) {
+                logits[token] -= 2.0f * bias_strength;
             }
         }
     }
 
     void boost_dialogue_enders(float* logits, float boost) {
-        for (llama_token token : dialogue_tokens) {
+        for (llama_token token : tables->dialogue_tokens) {
             logits[token] += boost;
         }
     }
@@ -5,6 +5,18 @@
 #include "llama-sampling.h"
 #include "llama-vocab.h"
 #include "zipf.h"
+#include "profiler.h"
+#include "roofline.h"
+#include "memstats.h"
+#include "npc.h"
+#include "backend.h"
+#include "engine.h"
+#include "loadtest.h"
+#include "sampling.h"
+#include "sweep.h"
+#include "corpusstats.h"
+#include "autoscale.h"
+#include "selftest.h"
 
 #include <iostream>
 #include <string>
@@ -20,279 +32,269 @@
 #include <deque>
 #include <unordered_set>
 #include <cctype>
+#include <cstring>
 
-// ---- Personality Modes ----
-struct PersonalityMode {
-    std::string mode_name;
-    std::string prompt_modifier;
-    int min_tokens;
-    int max_tokens;
-};
-
-const std::vector<PersonalityMode> ALL_PERSONALITY_MODES = {
-    { "friendly",   "You respond with warmth, politeness, and helpfulness. Speak in complete sentences.", 15, 150 },
-    { "rude",       "You respond curtly, with irritation, sarcasm, or disrespect. Keep responses brief but complete.", 8, 80 },
-    { "suspicious", "You respond with mistrust, guarded language, and evasiveness. Answer hesitantly.", 12, 120 },
-    { "deferential","You are very respectful and submissive to the speaker. Use honorifics and speak humbly.", 20, 200 },
-    { "stoic",      "You speak briefly with little emotion, but still provide complete thoughts.", 10, 60 }
-};
-
-const PersonalityMode* get_mode_by_name(const std::string& name) {
-    for (const auto& m : ALL_PERSONALITY_MODES)
-        if (m.mode_name == name) return &m;
-    return &ALL_PERSONALITY_MODES[0];
-}
-
-// ---- NPC Profiles ----
-struct NPCProfile {
-    std::string name;
-    std::string base_prompt;
-    std::vector<std::string> allowed_modes;
-    std::string background_info;
-};
-
-const std::vector<NPCProfile> NPCS = {
-    {   // 0
-        "Krackle",
-        "You are Krackle, the deadly front door guard to the Ramsel Dynasty. You are blunt, experienced, and have no time for nonsense. You've seen many adventurers come and go.",
-        {"friendly", "rude", "suspicious"},
-        "A veteran guard who has protected the dynasty for decades. Wears battle-scarred armor and carries an ancient sword."
-    },
-    {   // 1
-        "Mira",
-        "You are Mira, a world-weary but kind tavernkeeper who welcomes all sorts but is slow to trust. You've heard countless stories from travelers.",
-        {"friendly", "suspicious", "stoic"},
-        "Runs 'The Weary Traveler' tavern. Has graying hair and knowing eyes that have seen much of the world through her patrons."
-    },
-    {   // 2
-        "Feylan",
-        "You are Feylan, an anxious young court scribe. You are always deferential to those in authority and eager to help with your knowledge of court matters and records.",
-        {"deferential", "friendly", "stoic"},
-        "A young scholar with ink-stained fingers and nervous habits. Knows the history and procedures of the royal court intimately."
-    }
-};
-
-struct GameState {
-    std::string player_name;
-    std::string player_class;
-    std::string relationship;      // "stranger", "friend", "foe"
-    int player_level;
-    std::string recent_action;     // e.g. "threaten", "ask for help"
-};
-
-std::string to_lower(const std::string& s) {
-    std::string out = s;
-    std::transform(out.begin(), out.end(), out.begin(),
-        [](unsigned char c){ return std::tolower(c); });
-    return out;
-}
-
-// --- Smart Mode Selection ---
-std::string pick_mode_for_npc(const NPCProfile& npc, const GameState& state, const std::string& user_input) {
-    // THREAT OVERRIDE: If player threatens, always go "rude" if allowed
-    std::string input_lc = to_lower(user_input + " " + state.recent_action);
-    if ((input_lc.find("threaten") != std::string::npos ||
-         input_lc.find("kill") != std::string::npos ||
-         input_lc.find("harm") != std::string::npos ||
-         input_lc.find("attack") != std::string::npos) &&
-         std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "rude") != npc.allowed_modes.end())
-    {
-        return "rude";
-    }
-
-    // RELATIONSHIP (friend/foe/stranger)
-    if (state.relationship == "friend") {
-        if (std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "friendly") != npc.allowed_modes.end())
-            return "friendly";
-    } else if (state.relationship == "foe") {
-        if (std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "rude") != npc.allowed_modes.end())
-            return "rude";
-        if (std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "suspicious") != npc.allowed_modes.end())
-            return "suspicious";
-    } else if (state.relationship == "stranger") {
-        if (std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "suspicious") != npc.allowed_modes.end())
-            return "suspicious";
-    }
-
-    if (input_lc.find("thank") != std::string::npos && 
-        std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "friendly") != npc.allowed_modes.end())
-        return "friendly";
-
-    if ((input_lc.find("king") != std::string::npos || input_lc.find("queen") != std::string::npos || 
-         input_lc.find("majesty") != std::string::npos || input_lc.find("lord") != std::string::npos) &&
-        std::find(npc.allowed_modes.begin(), npc.allowed_modes.end(), "deferential") != npc.allowed_modes.end())
-        return "deferential";
-
-    return npc.allowed_modes[0];
-}
-
-// --- IMPROVED Prompt Construction ---
-std::string inject_prompt_context(const NPCProfile& npc, const PersonalityMode& mode,
-                                  const GameState& state, const std::string& user_input) {
-    std::ostringstream oss;
-    
-    // Use a more conversational format instead of strict ### headers
-    oss << "You are " << npc.name << ". " << npc.base_prompt << "\n\n";
-    oss << "Background: " << npc.background_info << "\n\n";
-    oss << "Current situation: ";
-    oss << "You are speaking with " << state.player_name;
-    oss << " (a level " << state.player_level << " " << state.player_class << ") ";
-    oss << "who is a " << state.relationship << " to you.\n\n";
-    
-    oss << "Your current mood/behavior: " << mode.prompt_modifier << "\n\n";
-    
-    oss << "Important rules:\n";
-    oss << "- Respond as " << npc.name << " would, staying in character\n";
-    oss << "- Give thoughtful, complete responses (not just one word)\n";
-    oss << "- Do not speak for the other person or continue their dialogue\n";
-    oss << "- Respond naturally as if in a real conversation\n\n";
-    
-    oss << state.player_name << " says: \"" << user_input << "\"\n\n";
-    oss << npc.name << " responds: \"";
-    
-    return oss.str();
-}
-
-std::string sanitize_token_text(const std::string & input) {
-    std::string output;
-    bool last_was_space = false;
-    for (size_t i = 0; i < input.size(); i++) {
-        unsigned char c = input[i];
-        char ch = (c == '\n' || (c >= 32 && c <= 126)) ? c : ' ';
-        if (ch == ' ') {
-            if (!last_was_space) {
-                output.push_back(ch);
-                last_was_space = true;
-            }
-        } else {
-            output.push_back(ch);
-            last_was_space = false;
+int main(int argc, char** argv) {
+    bool profile_ops = false;     // --profile: per-op timing via the graph eval callback
+    bool bench_roofline = false;  // --bench-roofline: bandwidth roofline report, then exit
+    bool load_test = false;       // --loadtest: simulated players against the engine, then exit
+    bool use_mock = false;        // --mock: deterministic mock backend instead of the GGUF model
+    bool self_test = false;       // --selftest: engine checks against the mock backend, then exit
+    double mock_speed = 1.0;      // --mock-speed X: divide the mock's simulated compute by X
+    EngineConfig engine_cfg;      // --workers N, --slots N, --coalesce off|greedy|always, --fast-sampling, --shadow X, --max-batch N, --prefill-workers N, --learn-token-stats, --scripted, --intent-confidence X
+    std::vector<std::pair<std::string, TenantPolicy>> tenant_policies;  // --tenant NAME:WEIGHT[:KV_SHARE]
+    int autoscale_max = 0;        // --autoscale N: grow from --workers up to N decode workers under load
+    LoadTestConfig load_cfg;      // --players N, --duration S, --think-ms MS, --seed N, --event-share X, --read-cps N, --diurnal S, --shards N, --hot-shard X, --routine-share X
+    std::string sampling_path;    // --sampling FILE: per NPC/mode sampling overrides
+    std::string sweep_path;       // --sweep FILE: replay script to run across --grid
+    std::string grid_spec;        // --grid "temp=0.6,0.8;top_k=20,40"
+    std::string stats_out_path;   // --build-stats OUT CORPUS...: write a token rank file, then exit
+    std::vector<std::string> corpus_paths;
+    std::string ranks_path;       // --token-ranks FILE: Zipf ranks from corpus counts
+    std::vector<int> prefill_cpus;  // --prefill-cores 0-3: pin prefill workers (with --prefill-workers)
+    std::vector<int> decode_cpus;   // --decode-cores 4-7: pin decode workers
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        auto next = [&](double fallback) { return (a + 1 < argc) ? std::atof(argv[++a]) : fallback; };
+        auto next_str = [&]() { return (a + 1 < argc) ? std::string(argv[++a]) : std::string(); };
+        if (arg == "--profile") profile_ops = true;
+        else if (arg == "--bench-roofline") bench_roofline = true;
+        else if (arg == "--loadtest") load_test = true;
+        else if (arg == "--mock") use_mock = true;
+        else if (arg == "--selftest") self_test = true;
+        else if (arg == "--mock-speed") mock_speed = next(mock_speed);
+        else if (arg == "--workers") engine_cfg.n_workers = (int)next(engine_cfg.n_workers);
+        else if (arg == "--slots") engine_cfg.slots_per_worker = (int)next(engine_cfg.slots_per_worker);
+        else if (arg == "--players") load_cfg.players = (int)next(load_cfg.players);
+        else if (arg == "--duration") load_cfg.duration_sec = next(load_cfg.duration_sec);
+        else if (arg == "--think-ms") load_cfg.think_ms_mean = next(load_cfg.think_ms_mean);
+        else if (arg == "--seed") load_cfg.seed = (uint32_t)next(load_cfg.seed);
+        else if (arg == "--event-share") load_cfg.event_share = next(load_cfg.event_share);
+        else if (arg == "--read-cps") load_cfg.read_cps = next(load_cfg.read_cps);
+        else if (arg == "--routine-share") load_cfg.routine_share = next(load_cfg.routine_share);
+        else if (arg == "--diurnal") load_cfg.diurnal_period_sec = next(load_cfg.diurnal_period_sec);
+        else if (arg == "--autoscale") autoscale_max = (int)next(autoscale_max);
+        else if (arg == "--shards") load_cfg.shards = (int)next(load_cfg.shards);
+        else if (arg == "--hot-shard") load_cfg.hot_shard_rate = next(load_cfg.hot_shard_rate);
+        else if (arg == "--tenant") {
+            std::stringstream spec(next_str());
+            std::string name, weight, share;
+            std::getline(spec, name, ':');
+            std::getline(spec, weight, ':');
+            std::getline(spec, share);
+            TenantPolicy policy;
+            if (!weight.empty()) policy.weight = std::atof(weight.c_str());
+            if (!share.empty()) policy.kv_share = std::atof(share.c_str());
+            tenant_policies.emplace_back(name, policy);
         }
-    }
-    return output;
-}
-
-// --- Enhanced truncation that preserves sentence completion ---
-std::string truncate_at_forbidden_speaker(const std::string& output, const GameState& state) {
-    std::vector<std::string> cues = {
-        "Adventurer:", "User:", "You say", "### Input:", "### Instruction:", 
-        "### Response:", "### Assistant:", "### Human:", state.player_name + ":"
-    };
-    
-    size_t cut = std::string::npos;
-    for (const auto& cue : cues) {
-        size_t pos = output.find(cue, 1);
-        if (pos != std::string::npos && (cut == std::string::npos || pos < cut)) {
-            cut = pos;
+        else if (arg == "--max-batch") engine_cfg.max_batch = (int)next(engine_cfg.max_batch);
+        else if (arg == "--prefill-workers") engine_cfg.prefill_workers = (int)next(engine_cfg.prefill_workers);
+        else if (arg == "--prefill-cores") prefill_cpus = roofline::parse_cpulist(next_str());
+        else if (arg == "--decode-cores") decode_cpus = roofline::parse_cpulist(next_str());
+        else if (arg == "--fast-sampling") engine_cfg.fast_sampling = true;
+        else if (arg == "--learn-token-stats") engine_cfg.learn_token_stats = true;
+        else if (arg == "--scripted") engine_cfg.scripted_replies = true;
+        else if (arg == "--intent-confidence") engine_cfg.intent_confidence = next(engine_cfg.intent_confidence);
+        else if (arg == "--shadow") engine_cfg.shadow_fraction = next(engine_cfg.shadow_fraction);
+        else if (arg == "--coalesce" && !parse_coalesce_policy(next_str(), engine_cfg.coalesce)) {
+            std::cerr << "--coalesce takes off, greedy or always" << std::endl;
+            return 1;
+        }
+        else if (arg == "--sampling") sampling_path = next_str();
+        else if (arg == "--sweep") sweep_path = next_str();
+        else if (arg == "--grid") grid_spec = next_str();
+        else if (arg == "--token-ranks") ranks_path = next_str();
+        else if (arg == "--build-stats") {
+            stats_out_path = next_str();
+            while (a + 1 < argc && std::strncmp(argv[a + 1], "--", 2) != 0) corpus_paths.push_back(argv[++a]);
         }
     }
-    
-    std::string result = (cut != std::string::npos) ? output.substr(0, cut) : output;
-    
-    // Try to end at a complete sentence
-    size_t last_period = result.find_last_of(".!?");
-    if (last_period != std::string::npos && last_period > result.length() * 0.7) {
-        result = result.substr(0, last_period + 1);
+    bool build_stats = !stats_out_path.empty();
+    if (build_stats && corpus_paths.empty()) {
+        std::cerr << "--build-stats needs at least one corpus file" << std::endl;
+        return 1;
+    }
+    bool sweep = !sweep_path.empty();
+    bool engine_tool = load_test || sweep;  // Non-interactive runs over a whole engine
+
+    SamplingProfiles sampling_profiles;
+    std::vector<ReplayLine> replay;
+    std::vector<SamplingOverrides> grid;
+    std::string config_error;
+    if ((!sampling_path.empty() && !sampling_profiles.load(sampling_path, config_error)) ||
+        (sweep && (!load_replay(sweep_path, replay, config_error) || !parse_grid(grid_spec, grid, config_error)))) {
+        std::cerr << config_error << std::endl;
+        return 1;
     }
-    
-    return result;
-}
-
-// --- IMPROVED Sampling Constants ---
-#define DEFAULT_MAX_OUTPUT_TOKENS 300
-#define DEFAULT_MAX_TOKENS 4096
-#define DEFAULT_N_CTX 1024  // Keep context realistic
-#define TOP_CAND 120        // number of logits to keep per step
-#define TOP_K 40            // Reduced for better quality
-#define TOP_P 0.95f         // Increased for more variety
-#define TEMP 0.8f           // Reduced temperature for better coherence
-#define ALPHA 0.1f          // Reduced alpha
-#define BASELINE 3.0f       // Adjusted baseline
-#define MIN_SCALING 0.7f
-#define MAX_SCALING 1.3f
-#define COMMON_TOKEN_THRESHOLD 100
-#define HIGH_COMMON_PENALTY 0.7f
-#define LOW_COMMON_PENALTY 0.9f
-#define EARLY_STOP_STREAK_THRESHOLD 15
-#define MIN_RESPONSE_TOKENS 8
-
-// DynamicSamplingParams dynamic_params;
 
+    if (self_test) return selftest::run(std::cout);
 
-int main(int argc, char** argv) {
-    std::cout << "Choose NPC to converse with:\n";
-    for (size_t i = 0; i < NPCS.size(); ++i)
-        std::cout << "  " << i << ": " << NPCS[i].name << " - " << NPCS[i].base_prompt << "\n";
     int npc_idx = 0;
-    std::cout << "Enter NPC number: ";
-    std::cin >> npc_idx; std::cin.ignore();
-    if (npc_idx < 0 || npc_idx >= (int)NPCS.size()) npc_idx = 0;
-    const NPCProfile& npc = NPCS[npc_idx];
-
     GameState state;
-    std::cout << "Enter your character's name: "; std::getline(std::cin, state.player_name);
-    std::cout << "Enter your character's class: "; std::getline(std::cin, state.player_class);
-    std::cout << "Enter your level: "; std::cin >> state.player_level; std::cin.ignore();
-    std::cout << "How do you stand to " << npc.name << "? (stranger/friend/foe):  ";
-    std::getline(std::cin, state.relationship);
-    if (state.relationship.empty()) state.relationship = "stranger";
-    std::cout << "What was your recent action (e.g., 'threaten', 'greet', 'ask for help')? ";
-    std::getline(std::cin, state.recent_action);
+    if (!bench_roofline && !engine_tool && !build_stats) {
+        std::cout << "Choose NPC to converse with:\n";
+        for (size_t i = 0; i < NPCS.size(); ++i)
+            std::cout << "  " << i << ": " << NPCS[i].name << " - " << NPCS[i].base_prompt << "\n";
+        std::cout << "Enter NPC number: ";
+        std::cin >> npc_idx; std::cin.ignore();
+        if (npc_idx < 0 || npc_idx >= (int)NPCS.size()) npc_idx = 0;
+
+        std::cout << "Enter your character's name: "; std::getline(std::cin, state.player_name);
+        std::cout << "Enter your character's class: "; std::getline(std::cin, state.player_class);
+        std::cout << "Enter your level: "; std::cin >> state.player_level; std::cin.ignore();
+        std::cout << "How do you stand to " << NPCS[npc_idx].name << "? (stranger/friend/foe):  ";
+        std::getline(std::cin, state.relationship);
+        if (state.relationship.empty()) state.relationship = "stranger";
+        std::cout << "What was your recent action (e.g., 'threaten', 'greet', 'ask for help')? ";
+        std::getline(std::cin, state.recent_action);
+    }
+    const NPCProfile& npc = NPCS[npc_idx];
 
     llama_backend_init();
 
+    MemoryAccountant memory;
+    memory.install_log_hook();
+    TokenRanks token_ranks;
+
+    // Load test or sampling sweep against an engine built from `factory`
+    auto run_engine_tool = [&](DialogueEngine::BackendFactory factory, DialogueEngine::BackendFactory prefill_factory,
+                               const std::string& backend_name) {
+        DialogueEngine engine(std::move(factory), engine_cfg, std::move(prefill_factory));
+        engine.set_sampling_profiles(sampling_profiles);
+        engine.set_token_ranks(token_ranks.order);
+        for (const auto& [name, policy] : tenant_policies) engine.set_tenant_policy(name, policy);
+        if (!engine.start()) {
+            std::cerr << "Failed to start engine" << std::endl;
+            return 1;
+        }
+        AutoscaleConfig scale_cfg;
+        scale_cfg.min_workers = engine_cfg.n_workers;
+        scale_cfg.max_workers = autoscale_max;
+        Autoscaler autoscaler(engine, scale_cfg);
+        if (autoscale_max > 0) autoscaler.start();
+        if (sweep) SamplingSweep().run(engine, replay, grid, std::cout);
+        if (load_test) LoadTest(load_cfg).run(engine, backend_name, std::cout);
+        if (autoscale_max > 0) {
+            autoscaler.stop();
+            autoscaler.report(std::cout);
+        }
+        std::cout << memory.summary_line(engine.session_memory());
+        engine.stop();
+        return 0;
+    };
+
+    if (engine_tool && use_mock) {
+        MockTiming timing = MockTiming{}.scaled(mock_speed);
+        int slots = engine_cfg.slots_per_worker;
+        int rc = run_engine_tool([=] { return std::make_unique<MockBackend>(slots, timing); },
+                                 [=] { return std::make_unique<MockBackend>(1, timing); }, "mock");
+        llama_backend_free();
+        return rc;
+    }
+
     const char* model_path = "model/mistral-7b-instruct-v0.1.Q4_K_M.gguf";
     llama_model_params model_params = llama_model_default_params();
     model_params.use_mmap = false;  // Re-enable mmap for better performance
     // model_params.n_gpu_layers = 35; // Increased GPU layers
+    model_params.vocab_only = build_stats;  // Counting tokens needs no weights
     llama_model* model = llama_model_load_from_file(model_path, model_params);
     if (!model) {
         std::cerr << "Failed to load model" << std::endl;
+        llama_backend_free();
         return 1;
     }
+    memory.set_model(model);
 
-    llama_context_params ctx_params = llama_context_default_params();
     unsigned int hw_threads = std::thread::hardware_concurrency();
     if (hw_threads == 0) hw_threads = 4; // Fallback when detection fails
+
+    std::string ranks_error;
+    if (build_stats) {
+        bool ok = CorpusStatsBuilder(llama_model_get_vocab(model), (int)hw_threads).run(corpus_paths, token_ranks, std::cout, ranks_error) &&
+                  token_ranks.save(stats_out_path, ranks_error);
+        if (ok) std::cout << "Wrote " << stats_out_path << " (load with --token-ranks)\n";
+        else std::cerr << ranks_error << std::endl;
+        llama_model_free(model);
+        llama_backend_free();
+        return ok ? 0 : 1;
+    }
+    if (!ranks_path.empty() && !token_ranks.load(ranks_path, llama_model_get_vocab(model), ranks_error)) {
+        std::cerr << ranks_error << std::endl;
+        llama_model_free(model);
+        llama_backend_free();
+        return 1;
+    }
+
+    llama_context_params ctx_params = llama_context_default_params();
     ctx_params.n_threads = std::max(4u, hw_threads);
     ctx_params.n_threads_batch = ctx_params.n_threads;
     std::cout << "Using " << ctx_params.n_threads << " threads\n";
     ctx_params.n_ctx = DEFAULT_N_CTX;
     ctx_params.flash_attn = false; // Disable flash attention for CPU build
 
-    llama_context* ctx = llama_init_from_model(model, ctx_params);
-    if (!ctx) {
-        std::cerr << "Failed to initialize context" << std::endl;
-        llama_model_free(model);
-        return 1;
+    // One profiler records one context's graph; the tools below run several contexts on their own threads
+    DecodeProfiler profiler;
+    if (profile_ops && (bench_roofline || engine_tool)) {
+        std::cerr << "--profile only applies to interactive chat; ignoring it" << std::endl;
     }
 
-    const llama_vocab* vocab = llama_model_get_vocab(model);
-
-    // Initialize Zipf accelerator
-    ZipfAccelerator zipf;
-    zipf.initialize(vocab);
-
-    // Remove old role-specific token logic (handled by ZipfAccelerator)
+    if (bench_roofline) {
+        int rc = roofline::run_benchmark(model, ctx_params, std::cout);
+        std::cout << memory.report({});
+        llama_model_free(model);
+        llama_backend_free();
+        return rc;
+    }
 
-    // Pre-compute simpler logit weights (optional, can be removed if not used elsewhere)
-    // std::vector<float> precomputed_log_weight(vocab->n_tokens());
-    // for (int token_id = 0; token_id < vocab->n_tokens(); ++token_id) {
-    //     int rank = zipf.get_rank(token_id);
-    //     precomputed_log_weight[token_id] = 1.0f / std::sqrt(rank + 1.0f);  // Gentler penalty
-    // }
+    if (engine_tool) {
+        // Workers share the cores instead of each claiming all of them. With
+        // a prefill pool, prefill gets half the cores (or --prefill-cores) and
+        // batches whole prompts; decode workers split the rest.
+        int workers = std::max({ 1, engine_cfg.n_workers, autoscale_max });
+        int prefillers = std::max(0, engine_cfg.prefill_workers);
+        int total_threads = ctx_params.n_threads;
+        int prefill_threads = prefillers ? std::max(1, total_threads / 2) : 0;
+        ctx_params.n_threads = std::max(1, (total_threads - prefill_threads) / workers);
+        ctx_params.n_threads_batch = ctx_params.n_threads;
+        llama_context_params prefill_params = ctx_params;
+        prefill_params.n_threads = std::max(1, prefill_threads / std::max(1, prefillers));
+        prefill_params.n_threads_batch = prefill_params.n_threads;
+        prefill_params.n_batch = std::max<uint32_t>(prefill_params.n_batch, DEFAULT_N_CTX);
+        prefill_params.n_ubatch = prefill_params.n_batch;
+
+        // Each backend takes a free slice of its core set and returns it when destroyed
+        CoreSlices decode_slices(decode_cpus, workers), prefill_slices(prefill_cpus, prefillers);
+        int slots = engine_cfg.slots_per_worker;
+        int rc = run_engine_tool([&, slots]() -> std::unique_ptr<DialogueBackend> {
+            return LlamaBackend::create(model, ctx_params, slots, decode_slices, &memory);
+        }, [&]() -> std::unique_ptr<DialogueBackend> {
+            return LlamaBackend::create(model, prefill_params, 1, prefill_slices, &memory);
+        }, "llama");
+        llama_model_free(model);
+        llama_backend_free();
+        return rc;
+    }
 
-    // Initialize sampler chain
-    llama_sampler_chain_params chain_params = llama_sampler_chain_default_params();
-    struct llama_sampler * sampler_chain = llama_sampler_chain_init(chain_params);
-    llama_sampler_chain_add(sampler_chain, llama_sampler_init_top_k(TOP_K));
-    llama_sampler_chain_add(sampler_chain, llama_sampler_init_top_p(TOP_P, 1));
-    llama_sampler_chain_add(sampler_chain, llama_sampler_init_temp(TEMP));
-    llama_sampler_chain_add(sampler_chain, llama_sampler_init_greedy());
+    if (profile_ops) {
+        profiler.attach(ctx_params);
+        std::cout << "Per-op profiling enabled (timings include per-node sync overhead)\n";
+    }
 
-    int n_vocab = vocab->n_tokens();
-    std::vector<llama_token_data> candidates(n_vocab);
-    std::vector<int> token_counts(n_vocab, 0);
+    // Interactive chat is a single-slot engine driven from the console
+    EngineConfig chat_cfg;
+    chat_cfg.learn_token_stats = engine_cfg.learn_token_stats;
+    chat_cfg.scripted_replies = engine_cfg.scripted_replies;
+    chat_cfg.intent_confidence = engine_cfg.intent_confidence;
+    DialogueEngine engine([&]() -> std::unique_ptr<DialogueBackend> {
+        return LlamaBackend::create(model, ctx_params, 1, &profiler);
+    }, chat_cfg);
+    engine.set_sampling_profiles(sampling_profiles);
+    engine.set_token_ranks(token_ranks.order);
+    if (!engine.start()) {
+        llama_model_free(model);
+        llama_backend_free();
+        return 1;
+    }
 
     std::ostringstream log_buffer;
     auto log_and_print = [&](const std::string& msg) {
@@ -300,7 +302,17 @@ int main(int argc, char** argv) {
         log_buffer << msg;
     };
 
-    log_and_print("\nImproved character chat (type 'exit' to quit):\n");
+    // Per-session share of the footprint (the model and context are shared)
+    auto session_memory = [&]() {
+        std::vector<SessionMemory> all = engine.session_memory();
+        SessionMemory console;
+        console.label = "console";
+        console.add("log_buffer", (size_t)std::max<std::streamoff>(log_buffer.tellp(), 0));
+        all.push_back(console);
+        return all;
+    };
+
+    log_and_print("\nImproved character chat (type 'stats' for memory, 'exit' to quit):\n");
 
     while (true) {
         log_and_print("\nYou: ");
@@ -308,145 +320,52 @@ int main(int argc, char** argv) {
         std::getline(std::cin, user_input);
         if (user_input == "exit") break;
         if (user_input.empty()) continue;
-
-        std::string mode_name = pick_mode_for_npc(npc, state, user_input);
-        const PersonalityMode* mode = get_mode_by_name(mode_name);
-
-        // Reuse sampler chain instead of recreating
-        llama_sampler_reset(sampler_chain);
-
-        llama_kv_cache_clear(ctx);
-
-        // Update Zipf context for this turn
-        zipf.update_context(npc.name, mode_name, vocab);
+        if (user_input == "stats") {
+            log_and_print(memory.report(session_memory()));
+            continue;
+        }
 
         auto start_time = std::chrono::steady_clock::now();
 
-        std::string full_prompt = inject_prompt_context(npc, *mode, state, user_input);
-        std::vector<llama_token> prompt_tokens(DEFAULT_MAX_TOKENS);
-        int32_t n_prompt = llama_tokenize(vocab, full_prompt.c_str(), full_prompt.size(),
-                                          prompt_tokens.data(), DEFAULT_MAX_TOKENS, true, true);
-        if (n_prompt <= 0) {
-            std::cerr << "Tokenization failed" << std::endl;
+        TurnRequest request;
+        request.session_id = state.player_name + "@" + npc.name;
+        request.npc_idx = npc_idx;
+        request.state = state;
+        request.utterance = user_input;
+        TurnResult result = engine.submit(std::move(request)).get();
+
+        if (result.n_tokens == 0 && !result.error.empty()) {
+            std::cerr << result.error << std::endl;
             continue;
         }
-        prompt_tokens.resize(n_prompt);
-        llama_batch prompt_batch = llama_batch_get_one(prompt_tokens.data(), prompt_tokens.size());
-        if (llama_decode(ctx, prompt_batch) != 0) {
-            std::cerr << "Error decoding prompt" << std::endl;
-            continue;
+        if (result.stop == StopReason::ERROR) {
+            std::cerr << "\n" << result.error << std::endl;
         }
 
-        std::vector<llama_token> assistant_tokens;
-        std::fill(token_counts.begin(), token_counts.end(), 0);
-        int common_token_streak = 0;
-        int min_tokens = std::max(MIN_RESPONSE_TOKENS, mode->min_tokens);
-        int max_tokens = std::min(DEFAULT_MAX_OUTPUT_TOKENS, mode->max_tokens);
-
-        std::string detok_so_far;
-        bool found_forbidden_speaker = false;
-        bool found_closing_quote = false;
-
-        for (int i = 0; i < max_tokens; ++i) {
-            float* logits = llama_get_logits(ctx);
-
-            // Apply Zipf acceleration (biases, role/mood, etc.)
-            zipf.accelerate_logits(logits, i, max_tokens - i);
-
-            // Build candidate list and trim to top logits
-            for (int token_id = 0; token_id < n_vocab; token_id++) {
-                candidates[token_id] = { token_id, logits[token_id], 0.0f };
-            }
-            llama_token_data_array candidates_arr = { candidates.data(), (size_t)n_vocab, false };
-            llama_sampler_apply(sampler_chain, &candidates_arr);
-            llama_token next_token = llama_sampler_sample(sampler_chain, ctx, -1);
-
-            // Apply repetition penalty only on trimmed set
-            for (size_t j = 0; j < candidates_arr.size; ++j) {
-                int token_id = candidates_arr.data[j].id;
-                if (token_counts[token_id] > 0) {
-                    float penalty = zipf.get_repetition_penalty(token_id, token_counts[token_id]);
-                    candidates_arr.data[j].logit *= penalty;
-                }
-            }
-
-            llama_sampler_apply(sampler_chain, &candidates_arr);
-            
-            if (next_token == llama_vocab_eos(vocab) || next_token == LLAMA_TOKEN_NULL) {
-                if (i >= min_tokens) break;
-                // If we haven't hit minimum tokens, try to continue
-                continue;
-            }
-
-            assistant_tokens.push_back(next_token);
-            token_counts[next_token]++;
-
-            // Check for natural stopping points
-            char token_buf[128] = {0};
-            llama_detokenize(vocab, &next_token, 1, token_buf, sizeof(token_buf), true, false);
-            std::string token_str(token_buf);
-            detok_so_far += token_str;
-            
-            // Look for closing quote (natural end of dialogue)
-            if (token_str.find("\"") != std::string::npos) {
-                found_closing_quote = true;
-                if (i >= min_tokens) break;
-            }
-            
-            // Check for forbidden speaker cues
-            std::string detok_lower = to_lower(detok_so_far);
-            if (detok_lower.find(to_lower(state.player_name) + ":") != std::string::npos ||
-                detok_lower.find("you say") != std::string::npos ||
-                detok_lower.find("adventurer:") != std::string::npos) {
-                found_forbidden_speaker = true;
-                break;
-            }
-
-            // Update context
-            std::vector<llama_token> token_vec = { next_token };
-            llama_batch token_batch = llama_batch_get_one(token_vec.data(), token_vec.size());
-            if (llama_decode(ctx, token_batch) != 0) {
-                std::cerr << "\nDecoding error during generation" << std::endl;
-                break;
-            }
-            
-            llama_sampler_accept(sampler_chain, next_token);
-        }
-
-        // Detokenize and clean up output
-        char output_buf[8192] = {0};
-        int32_t n_chars = llama_detokenize(vocab, assistant_tokens.data(), assistant_tokens.size(),
-                                           output_buf, sizeof(output_buf), true, false);
         std::string output;
-        if (n_chars < 0) {
-            output = "Detokenization failed\n";
+        if (result.text.empty() && !result.error.empty()) {
+            output = result.error + "\n";
             log_and_print(output);
         } else {
-            output = sanitize_token_text(std::string(output_buf, n_chars));
-            output = truncate_at_forbidden_speaker(output, state);
-            
-            // Clean up the output
-            if (output.empty() || output == "\"") {
-                output = "I... I'm not sure what to say.";
-            }
-            
-            // Remove leading/trailing quotes if present
-            if (output.front() == '"') output = output.substr(1);
-            if (!output.empty() && output.back() == '"') output.pop_back();
-            
+            output = result.text;
             log_and_print(npc.name + ": \"" + output + "\"\n");
         }
         
         auto end_time = std::chrono::steady_clock::now();
         auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
         double elapsed_sec = elapsed_ms / 1000.0;
-        double tokens_per_sec = (elapsed_sec > 0.0) ? (assistant_tokens.size() / elapsed_sec) : 0.0;
+        double tokens_per_sec = (elapsed_sec > 0.0) ? (result.n_tokens / elapsed_sec) : 0.0;
         std::string gen_stats = "[Gen " + std::to_string(elapsed_ms) + " ms | "
                                 + std::to_string(tokens_per_sec) + " tok/s]\n";
+        if (result.stop == StopReason::SCRIPTED) {
+            gen_stats = "[Scripted " + result.intent + " | " + std::to_string(elapsed_ms) + " ms]\n";
+        }
         log_and_print(gen_stats);
-
-        // Update Zipf conversation state with generated tokens
-        zipf.record_generation(assistant_tokens);
+        log_and_print(memory.summary_line(session_memory()));
+        if (profiler.is_enabled()) {
+            log_and_print(profiler.turn_report());
+            profiler.reset_turn();
+        }
 
         // Save conversation
         std::ofstream outfile("lastPrompt.txt", std::ios::app);
@@ -455,8 +374,11 @@ int main(int argc, char** argv) {
         outfile.close();
     }
 
-    llama_sampler_free(sampler_chain);
-    llama_free(ctx);
+    engine.stop();
+    if (profiler.is_enabled()) {
+        log_and_print(profiler.session_report());
+    }
+
     llama_model_free(model);
     llama_backend_free();
 